@@ -0,0 +1,145 @@
+"""
+Generates src/assets_data.h from the pages in pages/.
+
+Every static page becomes complete, ready-to-send HTTP responses (status
+line, headers and body) so the firmware answers with a single write:
+the identity response, an optional gzip response and a 304 reply for
+each. The gzip response is a different representation, so it has its
+own strong ETag (the identity one with -gz appended), and with it both
+responses carry Vary: Accept-Encoding.
+
+Runs as a PlatformIO pre-build script (extra_scripts) or standalone:
+    python3 scripts/gen_assets.py [--no-gzip]
+"""
+
+import gzip
+import hashlib
+import os
+import sys
+import time
+
+# (request paths, file, content type, status line)
+ASSETS = [
+    (["/", "/index.html"], "index.html", "text/html", "200 OK"),
+    ([], "404.html", "text/html", "404 Not Found"),
+]
+
+FOOTER = "<p><i>IncubatorServer {date} {time}</i></p>"
+
+
+def c_ident(name):
+    return "".join(c if c.isalnum() else "_" for c in name)
+
+
+def c_bytes(data):
+    rows = []
+    for i in range(0, len(data), 16):
+        rows.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]))
+    return ",\n".join(rows)
+
+
+def response(status, headers, body=b""):
+    head = "HTTP/1.1 %s\r\n" % status
+    head += "".join("%s: %s\r\n" % h for h in headers)
+    return head.encode("ascii") + b"\r\n" + body
+
+
+def render(path, footer):
+    with open(path, encoding="utf-8") as f:
+        text = f.read().replace("@FOOTER@", footer)
+    return "\r\n".join(text.splitlines()).encode("utf-8") + b"\r\n"
+
+
+def generate(project_dir, use_gzip=True):
+    pages_dir = os.path.join(project_dir, "pages")
+    out_path = os.path.join(project_dir, "src", "assets_data.h")
+
+    now = time.localtime(int(os.environ.get("SOURCE_DATE_EPOCH", time.time())))
+    footer = FOOTER.format(
+        date=time.strftime("%b %d %Y", now).replace(" 0", "  ", 1),
+        time=time.strftime("%H:%M:%S", now))
+
+    arrays = []
+    entries = []
+
+    for paths, name, content_type, status in ASSETS:
+        body = render(os.path.join(pages_dir, name), footer)
+        ident = "asset_" + c_ident(name)
+        ok = status.startswith("200")
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+
+        packed = gzip.compress(body, 9, mtime=0)
+        has_gzip = ok and use_gzip and len(packed) < len(body)
+        gz_etag = etag[:-1] + '-gz"'
+        vary = [("Vary", "Accept-Encoding")] if has_gzip else []
+
+        headers = [("Content-Type", content_type),
+                   ("Content-Length", len(body)),
+                   ("Connection", "close")]
+        if ok:
+            headers[1:1] = [("ETag", etag)] + vary
+        full = response(status, headers, body)
+        arrays.append((ident, full))
+
+        gz_ident = "NULL"
+        gz_nm_ident = "NULL"
+        if has_gzip:
+            gz_headers = [("Content-Type", content_type),
+                          ("ETag", gz_etag),
+                          ("Content-Encoding", "gzip"),
+                          ("Vary", "Accept-Encoding"),
+                          ("Content-Length", len(packed)),
+                          ("Connection", "close")]
+            gz_ident = ident + "_gz"
+            arrays.append((gz_ident, response(status, gz_headers, packed)))
+            gz_nm_ident = ident + "_gz_304"
+            arrays.append((gz_nm_ident, response(
+                "304 Not Modified",
+                [("ETag", gz_etag)] + vary + [("Connection", "close")])))
+
+        nm_ident = "NULL"
+        if ok:
+            nm_ident = ident + "_304"
+            arrays.append((nm_ident, response(
+                "304 Not Modified",
+                [("ETag", etag)] + vary + [("Connection", "close")])))
+
+        def ref(i):
+            return "{ NULL, 0 }" if i == "NULL" else "{ %s, sizeof(%s) }" % (i, i)
+
+        def quoted(tag):
+            return '"%s"' % tag.replace('"', '\\"')
+
+        for path in paths or [None]:
+            entries.append("  { %s, %s, %s, %s, %s, %s, %s }" % (
+                '"%s"' % path if path else "NULL",
+                quoted(etag) if ok else "NULL",
+                quoted(gz_etag) if has_gzip else "NULL",
+                ref(ident), ref(gz_ident), ref(nm_ident), ref(gz_nm_ident)))
+
+    lines = ["/* Generated by scripts/gen_assets.py from pages/, do not edit. */",
+             "", "#ifndef ASSETS_DATA_H", "#define ASSETS_DATA_H", ""]
+    for ident, data in arrays:
+        lines += ["static const uint8_t %s[] = {" % ident, c_bytes(data), "};", ""]
+    lines += ["const Asset assets[] = {", ",\n".join(entries), "};", "",
+              "const size_t N_ASSETS = sizeof(assets) / sizeof(assets[0]);",
+              "", "#endif", ""]
+
+    text = "\n".join(lines)
+    try:
+        with open(out_path, encoding="utf-8") as f:
+            if f.read() == text:
+                return
+    except OSError:
+        pass
+    with open(out_path, "w", encoding="utf-8") as f:
+        f.write(text)
+
+
+if __name__ == "__main__":
+    generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+             "--no-gzip" not in sys.argv[1:])
+else:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+    generate(env.subst("$PROJECT_DIR"),  # noqa: F821
+             "-DASSETS_NO_GZIP" not in env.subst("$BUILD_FLAGS"))  # noqa: F821
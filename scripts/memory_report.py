@@ -0,0 +1,120 @@
+"""
+Writes a per-file memory report of the firmware to memory_report.txt in
+the build directory: static RAM (.data + .bss) and flash of every source
+file of src/, the share of the framework and libraries, and the largest
+stack frame of every file (from the -fstack-usage .su files).
+
+The frame column is one function's own frame, not the stack depth of a
+task: frames are not summed along call chains, so a deep chain of small
+frames reports less than it uses. Summing them needs the call graph
+(-fcallgraph-info, GCC 10 and later), which the RP2040 toolchain of
+the platform does not promise.
+
+Runs as a PlatformIO post script of the heapfree env or standalone:
+    python3 scripts/memory_report.py <build dir> [toolchain prefix]
+"""
+
+import glob
+import os
+import subprocess
+import sys
+
+
+def run(tool, *args):
+    return subprocess.run([tool] + list(args), capture_output=True,
+                          text=True, check=True).stdout
+
+
+def object_sizes(nm, path):
+    """(ram, flash) of one object file"""
+    ram = flash = 0
+    for line in run(nm, "-S", "--size-sort", path).splitlines():
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        size, kind = int(fields[1], 16), fields[2]
+        if kind in "bB":
+            ram += size
+        elif kind in "dD":
+            ram += size
+            flash += size
+        elif kind in "tTrR":
+            flash += size
+    return ram, flash
+
+
+def max_frame(su_path):
+    """largest stack frame of a .su file as (bytes, function)"""
+    best = (0, "")
+    try:
+        with open(su_path) as f:
+            for line in f:
+                fields = line.rstrip("\n").split("\t")
+                if len(fields) >= 2 and int(fields[1]) > best[0]:
+                    best = (int(fields[1]), fields[0].split(":")[-1])
+    except (OSError, ValueError):
+        pass
+    return best
+
+
+def elf_totals(size, elf):
+    """(ram, flash) of the whole firmware"""
+    ram = flash = 0
+    for line in run(size, "-A", elf).splitlines():
+        fields = line.split()
+        if len(fields) < 2 or not fields[1].isdigit():
+            continue
+        name, n = fields[0], int(fields[1])
+        if name in (".data", ".bss", ".uninitialized_data", ".heap"):
+            ram += n
+        if name in (".text", ".rodata", ".data", ".ARM.exidx", ".boot2"):
+            flash += n
+    return ram, flash
+
+
+def report(build_dir, prefix):
+    nm, size = prefix + "nm", prefix + "size"
+    objects = sorted(glob.glob(os.path.join(build_dir, "src", "**", "*.o"),
+                               recursive=True))
+
+    rows = []
+    for obj in objects:
+        ram, flash = object_sizes(nm, obj)
+        frame, func = max_frame(obj[:-2] + ".su")
+        rows.append((os.path.relpath(obj, os.path.join(build_dir, "src"))[:-2],
+                     ram, flash, frame, func))
+    rows.sort(key=lambda r: r[1], reverse=True)
+
+    lines = ["%-24s %8s %8s %7s  %s" % ("file", "ram", "flash", "frame",
+                                        "largest frame")]
+    for name, ram, flash, frame, func in rows:
+        lines.append("%-24s %8d %8d %7d  %s" % (name, ram, flash, frame, func))
+
+    own_ram = sum(r[1] for r in rows)
+    own_flash = sum(r[2] for r in rows)
+    lines.append("%-24s %8d %8d" % ("src total", own_ram, own_flash))
+
+    elfs = glob.glob(os.path.join(build_dir, "*.elf"))
+    if elfs:
+        ram, flash = elf_totals(size, elfs[0])
+        lines.append("%-24s %8d %8d" % ("framework + libs",
+                                         ram - own_ram, flash - own_flash))
+        lines.append("%-24s %8d %8d" % ("firmware", ram, flash))
+
+    text = "\n".join(lines) + "\n"
+    with open(os.path.join(build_dir, "memory_report.txt"), "w") as f:
+        f.write(text)
+    return text
+
+
+if __name__ == "__main__":
+    sys.stdout.write(report(sys.argv[1],
+                            sys.argv[2] if len(sys.argv) > 2 else ""))
+else:
+    Import("env")  # noqa: F821 (provided by PlatformIO)
+
+    def after_build(source, target, env):
+        prefix = env.subst("$NM")[:-2]
+        print(report(env.subst("$BUILD_DIR"), prefix))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", after_build)  # noqa: F821
@@ -10,6 +10,7 @@
 #define TYPE_AUTO 0x80
 
 #define MAX_PROGRAM_LEN 5
+#define N_PROGRAMS 2
 
 typedef struct {
     unsigned long begin, end;
@@ -24,7 +25,7 @@ typedef struct {
 } ProgramEntry;
 
 const ProgramEntry programIndex[3] = {
-    {TYPE_LEN, 2,  {}},
+    {TYPE_LEN, N_PROGRAMS, {}},
     {TYPE_HAND, 0, {}},
     {TYPE_AUTO, 3, {
         {TIME(0, 0, 0, 0), TIME(20*24, 0, 0, 0), 37.7f, 53, 12},
@@ -33,4 +34,7 @@ const ProgramEntry programIndex[3] = {
     }}
 };
 
+extern int nProgram;
+extern int handProgram;
+
 #endif
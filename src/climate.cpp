@@ -0,0 +1,34 @@
+#include "climate.h"
+
+#include <math.h>
+
+#include "constants.h"
+
+void ClimateController::begin(uint32_t now) {
+  heater = false;
+  ring = false;
+  ventil = false;
+  wetter = false;
+
+  heating.begin();
+  humidifier.begin(now);
+}
+
+void ClimateController::updateThermal(float temperature, float neededTemperature,
+                                      float previewTemperature)
+{
+  heater = heating.update(temperature, neededTemperature, previewTemperature);
+
+  ring = (temperature >= ALARM_TEMPERATURE)
+    || isnan(temperature) || (temperature == TEMP_ERROR);
+
+  if (temperature >= STOP_TEMPERATURE && ring) {
+    ventil = true;
+  } else if (temperature <= neededTemperature) {
+    ventil = false;
+  }
+}
+
+void ClimateController::updateHumidity(float humidity, float neededHumidity, uint32_t now) {
+  wetter = humidifier.update(humidity, neededHumidity, now);
+}
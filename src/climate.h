@@ -0,0 +1,36 @@
+#ifndef CLIMATE_H
+#define CLIMATE_H
+
+#include <stdint.h>
+
+#include "humidity.h"
+#include "thermal.h"
+
+/*
+ * Heater, alarm, vent and wetter decisions of one zone from its fused
+ * temperature and humidity. Pure code without Arduino calls, so that
+ * tools/replay can run it against a recorded trace.
+ */
+class ClimateController {
+  public:
+    void begin(uint32_t now);
+
+    /* heater, alarm and vent; runs from the safety timer every
+       SAFETY_PERIOD. previewTemperature is the setpoint one model
+       dead time ahead. */
+    void updateThermal(float temperature, float neededTemperature,
+                       float previewTemperature);
+
+    /* wetter; runs from loop() */
+    void updateHumidity(float humidity, float neededHumidity, uint32_t now);
+
+    volatile bool heater;
+    volatile bool ring;
+    volatile bool ventil;
+    bool wetter;
+
+    HeaterController heating;
+    HumidityController humidifier;
+};
+
+#endif
@@ -11,13 +11,23 @@
 #define OFF HIGH
 
 #define TEMPERATURE_HYSTERESIS 0.3F 
-#define HUMIDITY_HYSTERESIS 5
+#define HUMIDITY_DEADBAND 1
 
 #define UPDATE_PERIOD 2000
 #define ROTATION_PERIOD 2000
 
-#define WET_PERIOD 120000L
-#define WET_TIME 300
+#define MIN_WET_PULSE 100
+#define MAX_WET_PULSE 3000
+#define MIN_WET_OFF_TIME 30000L
+
+#define HUMID_INITIAL_GAIN 5.0F
+#define HUMID_MIN_GAIN 0.5F
+#define HUMID_MAX_GAIN 50.0F
+#define HUMID_PULSE_FRACTION 0.7F
+#define HUMID_LEARN_RATE 0.3F
+#define HUMID_SETTLE_TIME 60000L
+#define HUMID_LOSS_PERIOD 30000L
+#define HUMID_DUTY_WINDOW 3600000L
 
 #define MENU_SWITCH_PERIOD 300000L
 
@@ -36,6 +46,98 @@
 #define ALARM_TEMPERATURE 39
 #define STOP_TEMPERATURE 43
 
+#define SAFETY_PERIOD 100
+#define SAFETY_STALE_TIME 5000
+#define SENSOR_LOST_TIME 10000
+
+/* heater model and control, see thermal.h */
+#define THERMAL_WINDOW 60000
+#define THERMAL_MAX_DELAY 4
+#define THERMAL_OFFSET 37.0F
+#define THERMAL_INITIAL_POLE 0.98F
+#define THERMAL_FORGET 0.998F
+#define THERMAL_RLS_INIT 100.0F
+#define THERMAL_RLS_MAX_TRACE 1000.0F
+#define THERMAL_ERROR_ALPHA 0.02F
+#define THERMAL_MIN_SAMPLES 120
+#define THERMAL_MIN_GAIN 2.0F
+#define THERMAL_MAX_GAIN 200.0F
+#define THERMAL_MAX_TAU 20000.0F
+#define THERMAL_MIN_TC 120.0F
+#define THERMAL_GUARD 0.5F
+#define THERMAL_MIN_PULSE 5000
+#define THERMAL_TUNE_HYSTERESIS 0.1F
+#define THERMAL_TUNE_CYCLES 3
+#define THERMAL_TUNE_TIMEOUT (4UL * 3600 * 1000)
+
+#define DHT_PERIOD 2000
+#define MAX_THERMO_PROBES 3
+
+#define FUSION_ALPHA 0.3F
+#define FUSION_OUTLIER_DELTA 1.0F
+#define FUSION_OFFSET_GAIN 0.01F
+#define FUSION_MIN_VALUE -20
+#define FUSION_MAX_VALUE 80
+#define FUSION_STALE_TIME 10000
+#define FUSION_LOSS_TIME 10000
+#define FUSION_DHT_WEIGHT 0.5F
+
+#define WATCHDOG_TIMEOUT 4000
+#define WATCHDOG_STALL_TIME 3000
+#define WATCHDOG_CHECK_PERIOD 100
+
+#define BUDGET_INPUTS 20
+#define BUDGET_ZONES 1000
+#define BUDGET_DISPLAY 100
+#define BUDGET_NETWORK 200
+#define BUDGET_STORAGE 300
+
+#define REQUEST_TIMEOUT 1000
+
+#define ANSWER_SIZE 2048
+#define FORMAT_BUFFER_SIZE 512
+#define HEADER_BUFFER_SIZE 96
+
+#define RELAY_MAX_PIN 32
+
+#define NET_SLICE_US 5000
+#define NET_READ_CHUNK 128
+#define NET_WRITE_CHUNK 512
+#define NET_BODY_IDLE 200
+#define NET_RATE_CLIENTS 8
+#define NET_RATE 5.0F
+#define NET_RATE_BURST 10
+#define NET_SHED_LOAD 0.5F
+#define NET_LOAD_ALPHA 0.05F
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+
+/* the trace region is the topmost part of the 16 MB flash */
+#define TRACE_FLASH_TOP (6UL * 1024 * 1024)
+#define TRACE_FLASH_SIZE (6UL * 1024 * 1024)
+#define TRACE_MAGIC 0x31435254UL
+#define TRACE_READ_PAGES 3
+/* heater state for replays that start mid-run, every 10 windows */
+#define TRACE_HEATER_WINDOWS 10
+
+/* the compressed long-term log, the 3 MB below the trace */
+#define HISTORY_FLASH_TOP (9UL * 1024 * 1024)
+#define HISTORY_FLASH_SIZE (3UL * 1024 * 1024)
+#define HISTORY_MAGIC 0x31545348UL
+#define HISTORY_BLOCK_SIZE FLASH_SECTOR_SIZE
+#define HISTORY_PERIOD 10000
+#define HISTORY_INDEX_ROWS 16
+#define HISTORY_READ_ROWS 48
+#define HISTORY_RAW_SIZE 128
+
+/* the event log, the 256 KB below the history */
+#define EVENTS_FLASH_SIZE (256UL * 1024)
+#define EVENTS_FLASH_TOP (HISTORY_FLASH_TOP + EVENTS_FLASH_SIZE)
+#define EVENTS_MAGIC 0x31545645UL
+#define EVENTS_FLUSH_TIME 10000
+#define EVENTS_READ_MAX 32
+
 #define MAX_ARGS 4
 #define MAX_CMD_LENGTH 255
 #define MAX_ARG_LENGTH 63
@@ -0,0 +1,369 @@
+#include "control.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "automode.h"
+#include "constants.h"
+#include "events.h"
+#include "history.h"
+#include "memory.h"
+#include "reply.h"
+#include "supervisor.h"
+#include "trace.h"
+
+static void printHex(Print & out, const uint8_t * data, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  char hex[64];
+
+  for (size_t i = 0; i < len; i += sizeof(hex) / 2) {
+    size_t n = 0;
+    for (size_t j = i; j < len && n < sizeof(hex); j++) {
+      hex[n++] = digits[data[j] >> 4];
+      hex[n++] = digits[data[j] & 0x0F];
+    }
+    out.write((const uint8_t *)hex, n);
+  }
+  out.print("\r\n");
+}
+
+void beginSession(Session & session) {
+  session.zone = 0;
+  session.transaction = false;
+  session.error = NULL;
+}
+
+void processCommand(char * cmd, Session & session, Print & out) {
+  static char empty[] = "";
+  char * args[MAX_ARGS];
+
+  int n_arg = 0;
+  args[n_arg++] = cmd;
+  for (char * p = cmd; *p && n_arg < MAX_ARGS; p++) {
+    if (*p == ' ') {
+      *p = '\0';
+      args[n_arg++] = p + 1;
+    }
+  }
+  while (n_arg < MAX_ARGS)
+    args[n_arg++] = empty;
+
+  if (strcmp(args[0], "zone") == 0) {
+    int n = atol(args[1]);
+    if (session.transaction) {
+      out.print("error transaction\r\n");
+      return;
+    }
+    if (n < 0 || n >= N_ZONES) {
+      out.print("no_zone\r\n");
+      return;
+    }
+    session.zone = n;
+    out.print("success\r\n");
+    return;
+  }
+
+  Zone & zone = zones[session.zone];
+
+  if (strcmp(args[0], "request_state") == 0) {
+    printFormat(out,
+      "current_temp %.2f\r\n"
+      "current_humid %.2f\r\n"
+      "heater %d\r\n"
+      "cooler %d\r\n"
+      "wetter %d\r\n"
+      "chamber %d\r\n"
+      "uptime %lu\r\n"
+      "zone %d\r\n"
+      "temp_sources %d\r\n"
+      "fusion_us %lu\r\n"
+      "fusion_max_us %lu\r\n"
+      "wet_pulses %lu\r\n"
+      "wet_time %lu\r\n"
+      "wet_duty %.4f\r\n"
+      "wet_gain %.2f\r\n",
+      (double)zone.currentTemperature,
+      (double)zone.currentHumidity,
+      (digitalRead(zone.pins->heater) == ON) ? 1 : 0,
+      (digitalRead(zone.pins->cooler) == ON) ? 1 : 0,
+      (zone.wetting) ? 1 : 0,
+      (int)zone.pos,
+      (millis() - zone.beginTimer) / 1000,
+      zone.number,
+      zone.thermoFusion.sources,
+      (unsigned long)zone.fusionUs,
+      (unsigned long)zone.fusionMaxUs,
+      (unsigned long)zone.climate.humidifier.pulses,
+      (unsigned long)zone.climate.humidifier.onTime,
+      (double)zone.climate.humidifier.duty,
+      (double)zone.climate.humidifier.gain);
+    if (zone.hasChanges) {
+      out.print("changed\r\n");
+      zone.hasChanges = false;
+    }
+    if (zone.alarm)
+      out.print("overheat\r\n");
+  } else if (strcmp(args[0], "request_config") == 0) {
+    printFormat(out,
+      "needed_temp %.2f\r\n"
+      "needed_humid %.2f\r\n"
+      "rotation_per_day %lu\r\n"
+      "number_of_programs %d\r\n"
+      "current_program %d\r\n"
+      "number_of_zones %d\r\n",
+      (double)zone.config().neededTemperature,
+      (double)zone.config().neededHumidity,
+      (unsigned long)zone.config().rotationsPerDay,
+      nProgram,
+      zone.currentProgramNumber,
+      N_ZONES);
+  } else if (strcmp(args[0], "request_thermal") == 0) {
+    const HeaterController & heating = zone.climate.heating;
+    static const char * MODE_NAMES[] = {"hysteresis", "autotune", "pi"};
+    printFormat(out,
+      "heater_mode %s\r\n"
+      "heater_duty %.3f\r\n"
+      "preview_temp %.2f\r\n"
+      "kc %.4f\r\n"
+      "ti %.0f\r\n"
+      "ku %.4f\r\n"
+      "pu %.0f\r\n"
+      "tune_result %d\r\n"
+      "model_valid %d\r\n"
+      "model_gain %.2f\r\n"
+      "model_tau %.0f\r\n"
+      "model_dead_time %.0f\r\n"
+      "model_ambient %.2f\r\n"
+      "model_samples %lu\r\n",
+      MODE_NAMES[heating.mode],
+      (double)heating.duty,
+      (double)zone.previewTemperature,
+      (double)heating.kc,
+      (double)heating.ti,
+      (double)heating.ku,
+      (double)heating.pu,
+      heating.tuneResult,
+      heating.model.valid() ? 1 : 0,
+      (double)heating.model.gain,
+      (double)heating.model.tau,
+      (double)heating.model.deadTime,
+      (double)heating.model.ambient,
+      (unsigned long)heating.model.samples);
+  } else if (strcmp(args[0], "autotune") == 0) {
+    /* autotune [0]: starts, or with 0 stops, a relay-feedback test */
+    bool start = strcmp(args[1], "0") != 0;
+    zone.climate.heating.requestAutotune(start);
+    traceTune(zone.number, start);
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "begin") == 0) {
+    if (session.transaction) {
+      out.print("error transaction\r\n");
+      return;
+    }
+    session.transaction = true;
+    session.error = NULL;
+    session.staged = zone.config();
+    session.stagedFields = 0;
+  } else if (strcmp(args[0], "commit") == 0) {
+    if (!session.transaction) {
+      out.print("error no_transaction\r\n");
+      return;
+    }
+    session.transaction = false;
+
+    ZoneConfig next = zone.config();
+    if (session.stagedFields & STAGED_TEMPERATURE)
+      next.neededTemperature = session.staged.neededTemperature;
+    if (session.stagedFields & STAGED_HUMIDITY)
+      next.neededHumidity = session.staged.neededHumidity;
+    if (session.stagedFields & STAGED_ROTATIONS)
+      next.rotationsPerDay = session.staged.rotationsPerDay;
+
+    const char * error = session.error;
+    if (!error)
+      error = zone.commitConfig(next);
+    if (error) {
+      printFormat(out, "error %s\r\n", error);
+    } else {
+      out.print("success\r\n");
+    }
+  } else if (strcmp(args[0], "abort") == 0) {
+    session.transaction = false;
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "needed_temp") == 0
+          || strcmp(args[0], "needed_humid") == 0
+          || strcmp(args[0], "rotations_per_day") == 0) {
+    ZoneConfig next = session.transaction ? session.staged : zone.config();
+    uint8_t field;
+
+    if (strcmp(args[0], "needed_temp") == 0) {
+      next.neededTemperature = atof(args[1]);
+      field = STAGED_TEMPERATURE;
+    } else if (strcmp(args[0], "needed_humid") == 0) {
+      next.neededHumidity = atof(args[1]);
+      field = STAGED_HUMIDITY;
+    } else {
+      next.rotationsPerDay = atol(args[1]);
+      field = STAGED_ROTATIONS;
+    }
+
+    if (session.transaction) {
+      /* validated as a whole on commit */
+      if (zone.currentProgram.type == TYPE_AUTO && !session.error)
+        session.error = "automatic";
+      session.staged = next;
+      session.stagedFields |= field;
+      return;
+    }
+
+    if (zone.currentProgram.type == TYPE_AUTO) {
+      out.print("automatic\r\n");
+      return;
+    }
+
+    const char * error = zone.commitConfig(next);
+    if (error) {
+      printFormat(out, "error %s\r\n", error);
+    } else {
+      out.print("success\r\n");
+    }
+  } else if (strcmp(args[0], "request_watchdog") == 0) {
+    for (int i = 0; i < N_TASKS; i++) {
+      printFormat(out,
+        "budget_%s %lu\r\n"
+        "max_us_%s %lu\r\n"
+        "overruns_%s %lu\r\n",
+        TASK_NAMES[i], (unsigned long)TASK_BUDGETS[i],
+        TASK_NAMES[i], (unsigned long)taskStats[i].maxUs,
+        TASK_NAMES[i], (unsigned long)taskStats[i].overruns);
+    }
+    printFormat(out, "watchdog_reset %d\r\n", resetByWatchdog ? 1 : 0);
+    if (lastCrash.count) {
+      printFormat(out,
+        "crash_count %lu\r\n"
+        "crash_task %s\r\n"
+        "crash_reason %s\r\n"
+        "crash_duration %lu\r\n"
+        "crash_uptime %lu\r\n",
+        (unsigned long)lastCrash.count,
+        (lastCrash.task < N_TASKS) ? TASK_NAMES[lastCrash.task] : "none",
+        (lastCrash.reason == CRASH_STALL) ? "stall" : "unknown",
+        (unsigned long)lastCrash.duration,
+        (unsigned long)lastCrash.uptime);
+    }
+  } else if (strcmp(args[0], "request_memory") == 0) {
+    printFormat(out,
+      "heap_locked %d\r\n"
+      "heap_violations %lu\r\n"
+      "heap_last_size %lu\r\n"
+      "heap_last_caller 0x%08lx\r\n",
+      heapStats.locked ? 1 : 0,
+      (unsigned long)heapStats.violations,
+      (unsigned long)heapStats.lastSize,
+      (unsigned long)heapStats.lastCaller);
+  } else if (strcmp(args[0], "trace_info") == 0) {
+    printFormat(out,
+      "trace_first %lu\r\n"
+      "trace_next %lu\r\n"
+      "trace_records %lu\r\n"
+      "trace_dropped %lu\r\n"
+      "trace_errors %lu\r\n",
+      (unsigned long)traceRing.first(),
+      (unsigned long)traceRing.next(),
+      (unsigned long)traceStats.records,
+      (unsigned long)traceStats.dropped,
+      (unsigned long)traceRing.errors);
+  } else if (strcmp(args[0], "trace_flush") == 0) {
+    traceFlush();
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "trace_read") == 0) {
+    static uint8_t page[FLASH_RING_PAYLOAD];
+    uint32_t seq = strtoul(args[1], NULL, 10);
+    long n = (args[2][0]) ? atol(args[2]) : 1;
+
+    if (n > TRACE_READ_PAGES)
+      n = TRACE_READ_PAGES;
+    for (; n > 0; n--, seq++) {
+      if (!traceRing.read(seq, page)) {
+        printFormat(out, "no_page %lu\r\n", (unsigned long)seq);
+        break;
+      }
+      printFormat(out, "page %lu ", (unsigned long)seq);
+      printHex(out, page, FLASH_RING_PAYLOAD);
+    }
+  } else if (strcmp(args[0], "events_after") == 0) {
+    long n = (args[2][0]) ? atol(args[2]) : EVENTS_READ_MAX;
+
+    if (n > EVENTS_READ_MAX)
+      n = EVENTS_READ_MAX;
+    eventsPrintAfter(out, strtoul(args[1], NULL, 10), n);
+  } else if (strcmp(args[0], "history_info") == 0) {
+    printFormat(out,
+      "history_first %lu\r\n"
+      "history_next %lu\r\n"
+      "history_boot %lu\r\n"
+      "history_samples %lu\r\n"
+      "history_blocks %lu\r\n"
+      "history_pages %lu\r\n"
+      "history_errors %lu\r\n"
+      "history_period %d\r\n",
+      (unsigned long)historyRing.first(),
+      (unsigned long)historyRing.next(),
+      (unsigned long)historyStats.boot,
+      (unsigned long)historyStats.samples,
+      (unsigned long)historyStats.blocks,
+      (unsigned long)historyStats.pages,
+      (unsigned long)historyRing.errors,
+      HISTORY_PERIOD);
+  } else if (strcmp(args[0], "history_index") == 0) {
+    long n = (args[2][0]) ? atol(args[2]) : HISTORY_INDEX_ROWS;
+
+    if (n > HISTORY_INDEX_ROWS)
+      n = HISTORY_INDEX_ROWS;
+    historyPrintIndex(out, strtoul(args[1], NULL, 10), n);
+  } else if (strcmp(args[0], "history_read") == 0) {
+    /* history_read <from> <to> [<seq>:<index>] of the session zone */
+    char * colon;
+    uint32_t seq = strtoul(args[3], &colon, 10);
+    uint32_t skip = (*colon == ':') ? strtoul(colon + 1, NULL, 10) : 0;
+    uint32_t to = (args[2][0]) ? strtoul(args[2], NULL, 10) : UINT32_MAX;
+
+    historyPrintRange(out, session.zone, strtoul(args[1], NULL, 10), to, seq, skip);
+  } else if (strcmp(args[0], "history_raw") == 0) {
+    static uint8_t raw[HISTORY_RAW_SIZE];
+    uint32_t seq = strtoul(args[1], NULL, 10);
+    uint32_t offset = strtoul(args[2], NULL, 10);
+
+    if (!historyRead(seq, offset, raw, sizeof(raw))) {
+      printFormat(out, "no_block %lu\r\n", (unsigned long)seq);
+      return;
+    }
+    printFormat(out, "raw %lu %lu ", (unsigned long)seq, (unsigned long)offset);
+    printHex(out, raw, sizeof(raw));
+  } else if (strcmp(args[0], "clear_watchdog") == 0) {
+    clearCrashRecord();
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "rotate_to") == 0) {
+    zone.rotateTimer = millis() + zone.config().period;
+    zone.needRotate = true;
+    zone.rotateTo = (Position)(atol(args[1]));
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "rotate_left") == 0) {
+    zone.rotateLeft();
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "rotate_right") == 0) {
+    zone.rotateRight();
+    out.print("success\r\n");
+  } else if (strcmp(args[0], "rotate_off") == 0) {
+    zone.rotateOff();
+    out.print("success\r\n");
+  }
+
+}
+
+/* a transaction still open at the end of the request is dropped */
+void endSession(Session & session, Print & out) {
+  if (session.transaction)
+    out.print("error uncommitted\r\n");
+  session.transaction = false;
+}
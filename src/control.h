@@ -0,0 +1,28 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <Arduino.h>
+
+#include "zone.h"
+
+/* settings a transaction has set, in Session.stagedFields */
+#define STAGED_TEMPERATURE 0x01
+#define STAGED_HUMIDITY 0x02
+#define STAGED_ROTATIONS 0x04
+
+/* State of one /control request: addressed zone and open transaction */
+typedef struct {
+  int zone;
+  bool transaction;
+  const char * error;
+  /* only the staged fields are merged into the zone's config on commit,
+     so changes made meanwhile by the menu or a program are kept */
+  ZoneConfig staged;
+  uint8_t stagedFields;
+} Session;
+
+void beginSession(Session & session);
+void processCommand(char * cmd, Session & session, Print & out);
+void endSession(Session & session, Print & out);
+
+#endif
@@ -0,0 +1,176 @@
+#include "events.h"
+
+#include <mbed.h>
+
+#include "constants.h"
+#include "reply.h"
+
+#define EVENTS_PER_PAGE (FLASH_RING_PAYLOAD / sizeof(Event))
+
+const char * EVENT_NAMES[N_EVENT_TYPES] = {
+  "boot", "crash", "overheat", "overheat_end", "config", "program",
+  "segment", "temp_lost", "temp_back", "humid_lost", "humid_back",
+  "turner_timeout", "safety_stale", "safety_fresh", "autotune"
+};
+
+const uint8_t EVENT_SEVERITIES[N_EVENT_TYPES] = {
+  EVENT_INFO, EVENT_CRITICAL, EVENT_CRITICAL, EVENT_INFO, EVENT_INFO,
+  EVENT_INFO, EVENT_INFO, EVENT_WARNING, EVENT_INFO, EVENT_WARNING,
+  EVENT_INFO, EVENT_WARNING, EVENT_CRITICAL, EVENT_INFO, EVENT_INFO
+};
+
+static const char * SEVERITY_NAMES[] = {"info", "warning", "critical"};
+
+EventStats eventStats;
+FlashRing eventRing;
+
+/* events not in flash yet */
+static Event tail[EVENTS_PER_PAGE];
+static size_t nTail = 0;
+static uint32_t tailTime;
+
+static uint32_t nextSeq = 1;
+static uint16_t boot = 1;
+
+/* the events of a flash page, in order */
+static size_t readPage(uint32_t seq, Event * events) {
+  static uint8_t payload[FLASH_RING_PAYLOAD];
+  size_t n = 0;
+
+  if (!eventRing.read(seq, payload))
+    return 0;
+
+  for (; n < EVENTS_PER_PAGE; n++) {
+    memcpy(&events[n], payload + n * sizeof(Event), sizeof(Event));
+    if (events[n].seq == 0xFFFFFFFFUL)
+      break;
+  }
+  return n;
+}
+
+void eventsBegin() {
+  Event events[EVENTS_PER_PAGE];
+
+  eventRing.begin(EVENTS_FLASH_TOP, EVENTS_FLASH_SIZE, EVENTS_MAGIC);
+  nTail = 0;
+
+  if (eventRing.next() != eventRing.first()) {
+    size_t n = readPage(eventRing.next() - 1, events);
+    /* up to a page of events may have been handed out from RAM and
+       lost with the reset, so their numbers are skipped */
+    if (n > 0) {
+      nextSeq = events[n - 1].seq + 1 + EVENTS_PER_PAGE;
+      boot = events[n - 1].boot + 1;
+    }
+  }
+
+  eventRecord(EVENT_NO_ZONE, EVENT_BOOT, 0);
+}
+
+void eventRecord(int zone, EventType type, int32_t value) {
+  core_util_critical_section_enter();
+
+  if (nTail == EVENTS_PER_PAGE) {
+    eventStats.dropped++;
+    core_util_critical_section_exit();
+    return;
+  }
+
+  Event & event = tail[nTail];
+  event.seq = nextSeq++;
+  event.time = millis();
+  event.boot = boot;
+  event.type = type;
+  event.zone = zone;
+  event.value = constrain(value, INT16_MIN, INT16_MAX);
+  event.reserved = 0xFFFF;
+
+  if (nTail++ == 0)
+    tailTime = event.time;
+  eventStats.recorded++;
+
+  core_util_critical_section_exit();
+}
+
+/* writes the events in RAM to flash, from loop() only */
+void eventsService() {
+  uint8_t payload[FLASH_RING_PAYLOAD];
+  size_t n;
+
+  if (!eventRing.ready || nTail == 0)
+    return;
+  if (nTail < EVENTS_PER_PAGE && (millis() - tailTime) < EVENTS_FLUSH_TIME)
+    return;
+  if (!eventRing.writable())
+    return;
+
+  memset(payload, 0xFF, sizeof(payload));
+  core_util_critical_section_enter();
+  n = nTail;
+  memcpy(payload, tail, n * sizeof(Event));
+  nTail = 0;
+  core_util_critical_section_exit();
+
+  if (eventRing.append(payload))
+    eventStats.pages++;
+  else
+    eventStats.dropped += n;
+}
+
+static void printEvent(Print & out, const Event & event) {
+  printFormat(out, "event %lu %u %lu %s %d %s %d\r\n",
+    (unsigned long)event.seq,
+    event.boot,
+    (unsigned long)event.time,
+    SEVERITY_NAMES[EVENT_SEVERITIES[event.type]],
+    event.zone,
+    EVENT_NAMES[event.type],
+    event.value);
+}
+
+void eventsPrintAfter(Print & out, uint32_t seq, int n) {
+  Event events[EVENTS_PER_PAGE];
+  uint32_t last;
+
+  /* the last flash page whose first event is not after seq + 1 */
+  uint32_t lo = eventRing.first();
+  uint32_t hi = eventRing.next();
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (readPage(mid, events) > 0 && events[0].seq <= seq + 1)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (uint32_t page = lo; n > 0 && page != eventRing.next(); page++) {
+    size_t count = readPage(page, events);
+    for (size_t i = 0; i < count && n > 0; i++) {
+      if ((int32_t)(events[i].seq - seq) <= 0)
+        continue;
+      printEvent(out, events[i]);
+      seq = events[i].seq;
+      n--;
+    }
+  }
+
+  /* then the ones still in RAM */
+  core_util_critical_section_enter();
+  size_t count = nTail;
+  memcpy(events, tail, count * sizeof(Event));
+  last = nextSeq - 1;
+  core_util_critical_section_exit();
+
+  for (size_t i = 0; i < count && n > 0; i++) {
+    if ((int32_t)(events[i].seq - seq) <= 0)
+      continue;
+    printEvent(out, events[i]);
+    seq = events[i].seq;
+    n--;
+  }
+
+  /* a cut reply ends at the last event printed */
+  if (n == 0)
+    last = seq;
+  printFormat(out, "events_last %lu\r\n", (unsigned long)last);
+}
@@ -0,0 +1,76 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+
+#include "flashring.h"
+
+/*
+ * Append-only log of the events a monitor must not miss: alarms,
+ * sensor losses, config and program changes, turner timeouts, resets.
+ * Every event gets a higher sequence number than the ones before it,
+ * also across resets, so clients fetch what is new with
+ * "events_after <seq>" and never clear each other's flags.
+ * Events collect in RAM and go to a flash ring EVENTS_FLUSH_TIME after
+ * the first of them, or when the page is full. eventRecord() may be
+ * called from interrupt context.
+ */
+
+enum EventType {
+  EVENT_BOOT = 0,
+  EVENT_CRASH,           /* watchdog reset; value: task << 8 | reason */
+  EVENT_OVERHEAT,        /* value: temperature in 1/100 degree */
+  EVENT_OVERHEAT_END,    /* value: temperature in 1/100 degree */
+  EVENT_CONFIG,          /* value: needed temperature in 1/100 degree */
+  EVENT_PROGRAM,         /* value: program number */
+  EVENT_SEGMENT,         /* value: segment of the program */
+  EVENT_TEMP_LOST,
+  EVENT_TEMP_BACK,
+  EVENT_HUMID_LOST,
+  EVENT_HUMID_BACK,
+  EVENT_TURNER_TIMEOUT,  /* value: position the turner did not reach */
+  EVENT_SAFETY_STALE,    /* value: stale episodes since the last one logged */
+  EVENT_SAFETY_FRESH,
+  EVENT_AUTOTUNE,        /* value: 0 started, 1 done, -1 failed or stopped */
+  N_EVENT_TYPES
+};
+
+enum EventSeverity {
+  EVENT_INFO = 0,
+  EVENT_WARNING,
+  EVENT_CRITICAL
+};
+
+#define EVENT_NO_ZONE -1
+
+typedef struct {
+  uint32_t seq;
+  uint32_t time;       /* ms since boot */
+  uint16_t boot;
+  uint8_t type;
+  int8_t zone;
+  int16_t value;
+  uint16_t reserved;
+} Event;
+
+typedef struct {
+  uint32_t recorded;
+  uint32_t pages;
+  uint32_t dropped;
+} EventStats;
+
+extern const char * EVENT_NAMES[N_EVENT_TYPES];
+extern const uint8_t EVENT_SEVERITIES[N_EVENT_TYPES];
+
+extern EventStats eventStats;
+extern FlashRing eventRing;
+
+void eventsBegin();
+void eventsService();
+void eventRecord(int zone, EventType type, int32_t value);
+
+/* "event" lines after seq, at most n, then "events_last" with the seq
+   to ask after next */
+void eventsPrintAfter(Print & out, uint32_t seq, int n);
+
+#endif
@@ -0,0 +1,168 @@
+#include "flashring.h"
+
+static mbed::FlashIAP flash;
+static bool flashReady = false;
+static bool erased = false;
+
+void FlashRing::newPass() {
+  erased = false;
+}
+
+bool FlashRing::writable() {
+  return ready && (!erased || pageAddress(nextPos) % FLASH_SECTOR_SIZE != 0);
+}
+
+bool FlashRing::begin(uint32_t top, uint32_t size, uint32_t magic,
+                      uint32_t pageSize)
+{
+  FlashPageHeader header;
+
+  ready = false;
+  errors = 0;
+  this->magic = magic;
+  this->pageSize = pageSize;
+
+  if (!flashReady) {
+    if (flash.init() != 0)
+      return false;
+    flashReady = true;
+  }
+
+  if (pageSize != FLASH_PAGE_SIZE && pageSize % FLASH_SECTOR_SIZE != 0)
+    return false;
+
+  start = flash.get_flash_start() + flash.get_flash_size() - top;
+  nPages = size / pageSize;
+  if (nPages * pageSize < 2 * FLASH_SECTOR_SIZE)
+    return false;
+
+  /* the newest page is the one with the highest sequence number */
+  bool found = false;
+  uint32_t headPos = 0;
+  uint32_t headSeq = 0;
+
+  for (uint32_t pos = 0; pos < nPages; pos++) {
+    flash.read(&header, pageAddress(pos), sizeof(header));
+    if (header.magic != magic)
+      continue;
+    if (!found || (int32_t)(header.seq - headSeq) > 0) {
+      headPos = pos;
+      headSeq = header.seq;
+      found = true;
+    }
+  }
+
+  if (!found) {
+    nextPos = 0;
+    nextSeq = 1;
+    count = 0;
+    ready = true;
+    return true;
+  }
+
+  /* walk back over the pages written before it */
+  count = 1;
+  while (count < nPages) {
+    uint32_t pos = (headPos + nPages - count) % nPages;
+    flash.read(&header, pageAddress(pos), sizeof(header));
+    if (header.magic != magic || header.seq != headSeq - count)
+      break;
+    count++;
+  }
+
+  nextPos = (headPos + 1) % nPages;
+  nextSeq = headSeq + 1;
+
+  /* skip pages left half-written by a reset inside the sector */
+  while (pageAddress(nextPos) % FLASH_SECTOR_SIZE != 0) {
+    flash.read(&header, pageAddress(nextPos), sizeof(header));
+    if (header.magic == 0xFFFFFFFFUL && header.seq == 0xFFFFFFFFUL)
+      break;
+    nextPos = (nextPos + 1) % nPages;
+    nextSeq++;
+    count++;
+  }
+
+  ready = true;
+  return true;
+}
+
+uint32_t FlashRing::open(const uint8_t * payload) {
+  static uint8_t page[FLASH_PAGE_SIZE];
+
+  if (!writable())
+    return 0;
+
+  uint32_t address = pageAddress(nextPos);
+  if (address % FLASH_SECTOR_SIZE == 0) {
+    uint32_t erase = (pageSize > FLASH_SECTOR_SIZE) ? pageSize : FLASH_SECTOR_SIZE;
+    erased = true;
+    if (flash.erase(address, erase) != 0) {
+      errors++;
+      return 0;
+    }
+    uint32_t lost = erase / pageSize;
+    if (count > nPages - lost)
+      count = nPages - lost;
+  }
+
+  FlashPageHeader header = {magic, nextSeq};
+  memcpy(page, &header, sizeof(header));
+  memcpy(page + sizeof(header), payload, FLASH_RING_PAYLOAD);
+
+  if (flash.program(page, address, FLASH_PAGE_SIZE) != 0) {
+    errors++;
+    return 0;
+  }
+
+  uint32_t seq = nextSeq;
+  nextPos = (nextPos + 1) % nPages;
+  nextSeq++;
+  if (count < nPages)
+    count++;
+  return seq;
+}
+
+bool FlashRing::append(const uint8_t * payload) {
+  return pageSize == FLASH_PAGE_SIZE && open(payload) != 0;
+}
+
+bool FlashRing::program(uint32_t seq, uint32_t offset, const uint8_t * data) {
+  uint32_t address;
+
+  if (offset == 0 || offset % FLASH_PAGE_SIZE != 0 || offset >= pageSize
+      || !locate(seq, address))
+    return false;
+
+  if (flash.program(data, address + offset, FLASH_PAGE_SIZE) != 0) {
+    errors++;
+    return false;
+  }
+  return true;
+}
+
+bool FlashRing::locate(uint32_t seq, uint32_t & address) {
+  FlashPageHeader header;
+
+  if (!ready || (nextSeq - seq) == 0 || (nextSeq - seq) > count)
+    return false;
+
+  uint32_t pos = (nextPos + nPages - (nextSeq - seq) % nPages) % nPages;
+  address = pageAddress(pos);
+  flash.read(&header, address, sizeof(header));
+  return header.magic == magic && header.seq == seq;
+}
+
+bool FlashRing::read(uint32_t seq, uint32_t offset, void * data, uint32_t len) {
+  uint32_t address;
+
+  if (offset + len > pageSize || !locate(seq, address))
+    return false;
+
+  flash.read(data, address + offset, len);
+  return true;
+}
+
+bool FlashRing::read(uint32_t seq, uint8_t * payload) {
+  return read(seq, sizeof(FlashPageHeader), payload, FLASH_RING_PAYLOAD);
+}
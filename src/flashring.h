@@ -0,0 +1,81 @@
+#ifndef FLASHRING_H
+#define FLASHRING_H
+
+#include <Arduino.h>
+#include <mbed.h>
+
+#include "constants.h"
+
+/*
+ * Ring of fixed-size pages in a region at the top of the QSPI flash.
+ * Every page starts with the ring's magic and a sequence number, so the
+ * write position is found again after a reset by scanning the headers.
+ * A sector is erased right before its first page is written, which
+ * drops the oldest pages of the ring.
+ *
+ * A ring page is one flash page (256 bytes) or a whole number of
+ * sectors. Large pages are written progressively: open() erases the
+ * page and writes its first flash page with the header, program()
+ * fills in the following flash pages later.
+ *
+ * Erasing and programming mask interrupts, the safety timer's too. A
+ * sector erase takes about 45 ms and up to 400 ms, a page program up
+ * to 3 ms, so all rings together erase at most one sector per loop
+ * pass: a ring that is not writable() defers its page to a later
+ * pass. The safety timer is thus late by at most one erase and a few
+ * programs, 400 ms plus one loop pass in the worst case.
+ */
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+} FlashPageHeader;
+
+#define FLASH_RING_PAYLOAD (FLASH_PAGE_SIZE - sizeof(FlashPageHeader))
+
+class FlashRing {
+  public:
+    /* region of size bytes ending top bytes below the end of flash */
+    bool begin(uint32_t top, uint32_t size, uint32_t magic,
+               uint32_t pageSize = FLASH_PAGE_SIZE);
+
+    /* from loop(), before the storage tasks: allows the next erase */
+    static void newPass();
+    /* false if the next page needs an erase and this pass had one */
+    bool writable();
+
+    /* writes a single-flash-page ring page */
+    bool append(const uint8_t * payload);
+
+    /* starts the next ring page with FLASH_RING_PAYLOAD bytes after the
+       header; returns its sequence number, 0 on failure */
+    uint32_t open(const uint8_t * payload);
+    /* one flash page at offset (a multiple of FLASH_PAGE_SIZE) */
+    bool program(uint32_t seq, uint32_t offset, const uint8_t * data);
+
+    /* payload of a single-flash-page ring page */
+    bool read(uint32_t seq, uint8_t * payload);
+    /* any part of a ring page; offset counts from the header */
+    bool read(uint32_t seq, uint32_t offset, void * data, uint32_t len);
+
+    uint32_t first() { return nextSeq - count; }
+    uint32_t next() { return nextSeq; }
+
+    uint32_t pageSize;
+    bool ready;
+    uint32_t errors;
+
+  private:
+    uint32_t pageAddress(uint32_t pos) { return start + pos * pageSize; }
+    bool locate(uint32_t seq, uint32_t & address);
+
+    uint32_t magic;
+    uint32_t start;
+    uint32_t nPages;
+
+    uint32_t nextPos;
+    uint32_t nextSeq;
+    uint32_t count;
+};
+
+#endif
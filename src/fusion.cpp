@@ -0,0 +1,141 @@
+#include "fusion.h"
+
+#include <math.h>
+
+#include "constants.h"
+
+static float median(const float * values, int n) {
+  float sorted[FUSION_MAX_PROBES > FUSION_MEDIAN ? FUSION_MAX_PROBES : FUSION_MEDIAN];
+
+  for (int i = 0; i < n; i++) {
+    int j = i;
+    for (; j > 0 && sorted[j - 1] > values[i]; j--)
+      sorted[j] = sorted[j - 1];
+    sorted[j] = values[i];
+  }
+
+  if (n % 2)
+    return sorted[n / 2];
+  return (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+void SensorFusion::begin(int nProbes) {
+  this->nProbes = (nProbes > FUSION_MAX_PROBES) ? FUSION_MAX_PROBES : nProbes;
+
+  for (int i = 0; i < FUSION_MAX_PROBES; i++) {
+    probes[i] = Probe();
+    probes[i].weight = 1;
+  }
+
+  value = TEMP_ERROR;
+  valid = false;
+  sources = 0;
+  lastGood = 0;
+}
+
+void SensorFusion::setWeight(int probe, float weight) {
+  probes[probe].weight = weight;
+}
+
+void SensorFusion::sample(int probe, float value, uint32_t now) {
+  Probe & p = probes[probe];
+
+  if (isnan(value) || value == TEMP_ERROR
+      || value < FUSION_MIN_VALUE || value > FUSION_MAX_VALUE)
+    return;
+
+  /* a probe back from a dropout starts from a clean window */
+  bool fresh = !probeValid(probe, now);
+  if (fresh) {
+    p.count = 0;
+    p.next = 0;
+  }
+
+  p.window[p.next] = value;
+  p.next = (p.next + 1) % FUSION_MEDIAN;
+  if (p.count < FUSION_MEDIAN)
+    p.count++;
+
+  float m = median(p.window, p.count);
+  if (fresh)
+    p.filtered = m;
+  else
+    p.filtered += FUSION_ALPHA * (m - p.filtered);
+
+  p.lastSample = now;
+
+  /* offsets are learnt against probe 0 while both agree */
+  if (probe > 0 && probeValid(0, now) && (p.accepted || !p.calibrated)) {
+    float diff = p.filtered - probes[0].filtered;
+    if (!p.calibrated)
+      p.offset = diff;
+    else
+      p.offset += FUSION_OFFSET_GAIN * (diff - p.offset);
+    p.calibrated = true;
+  }
+}
+
+bool SensorFusion::probeValid(int probe, uint32_t now) {
+  const Probe & p = probes[probe];
+  return p.count > 0 && (now - p.lastSample) < FUSION_STALE_TIME;
+}
+
+void SensorFusion::update(uint32_t now) {
+  float corrected[FUSION_MAX_PROBES];
+  float candidates[FUSION_MAX_PROBES];
+  int n = 0;
+
+  for (int i = 0; i < nProbes; i++) {
+    Probe & p = probes[i];
+    p.accepted = false;
+
+    if (!probeValid(i, now))
+      continue;
+
+    corrected[i] = p.filtered - p.offset;
+    candidates[n++] = corrected[i];
+  }
+
+  if (n == 0) {
+    sources = 0;
+    valid = valid && (now - lastGood) < FUSION_LOSS_TIME;
+    if (!valid)
+      value = TEMP_ERROR;
+    return;
+  }
+
+  /* with two probes the median cannot tell who is wrong */
+  float consensus = median(candidates, n);
+  if (n == 2 && fabsf(candidates[0] - candidates[1]) > FUSION_OUTLIER_DELTA)
+    consensus = (valid && fabsf(candidates[0] - value) > fabsf(candidates[1] - value))
+      ? candidates[1] : candidates[0];
+
+  float sum = 0, weights = 0;
+  sources = 0;
+  for (int i = 0; i < nProbes; i++) {
+    Probe & p = probes[i];
+    if (!probeValid(i, now))
+      continue;
+
+    if (fabsf(corrected[i] - consensus) > FUSION_OUTLIER_DELTA) {
+      p.rejects++;
+      continue;
+    }
+
+    p.accepted = true;
+    sum += p.weight * corrected[i];
+    weights += p.weight;
+    sources++;
+  }
+
+  /* an even split leaves nobody near the median: keep the first */
+  if (sources == 0) {
+    sum = candidates[0];
+    weights = 1;
+    sources = 1;
+  }
+
+  value = sum / weights;
+  valid = true;
+  lastGood = now;
+}
@@ -0,0 +1,48 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdint.h>
+
+#define FUSION_MAX_PROBES 4
+#define FUSION_MEDIAN 5
+
+/*
+ * Fuses several temperature probes of one zone into one reading.
+ * Every probe is median- and EMA-filtered on its own; the probes are
+ * then cross-checked, outliers rejected, and the survivors averaged.
+ * Probe 0 is the reference: the other probes learn their offset to it
+ * while both work, so losing a probe does not step the result.
+ */
+
+typedef struct {
+  float window[FUSION_MEDIAN];
+  uint8_t count, next;
+  float filtered;
+  float offset;
+  float weight;
+  uint32_t lastSample;
+  uint32_t rejects;
+  bool calibrated;
+  bool accepted;
+} Probe;
+
+class SensorFusion {
+  public:
+    void begin(int nProbes);
+    void setWeight(int probe, float weight);
+
+    void sample(int probe, float value, uint32_t now);
+    void update(uint32_t now);
+
+    bool probeValid(int probe, uint32_t now);
+
+    int nProbes;
+    Probe probes[FUSION_MAX_PROBES];
+
+    float value;
+    bool valid;
+    int sources;
+    uint32_t lastGood;
+};
+
+#endif
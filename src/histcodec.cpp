@@ -0,0 +1,141 @@
+#include "histcodec.h"
+
+/* pages start erased, so only the zero bits are written */
+static void putBits(uint8_t * page, uint32_t & bit, uint32_t value, int n) {
+  while (n-- > 0) {
+    if (!((value >> n) & 1))
+      page[bit >> 3] &= ~(0x80 >> (bit & 7));
+    bit++;
+  }
+}
+
+static uint32_t getBits(const uint8_t * page, uint32_t & bit, int n) {
+  uint32_t value = 0;
+  while (n-- > 0) {
+    value = (value << 1) | ((page[bit >> 3] >> (7 - (bit & 7))) & 1);
+    bit++;
+  }
+  return value;
+}
+
+static int32_t signExtend(uint32_t value, int n) {
+  return (int32_t)(value << (32 - n)) >> (32 - n);
+}
+
+void HistoryCodec::begin(uint32_t startTime) {
+  prevTime = startTime;
+  prevDelta = 0;
+  for (int k = 0; k < 2; k++) {
+    prevValue[k] = 0;
+    leading[k] = 0xFF;
+    trailing[k] = 0;
+  }
+}
+
+/* '0' same, '10' bits inside the last window, '11' new window */
+void HistoryCodec::encodeValue(uint8_t * page, uint32_t & bit, int k, uint32_t value) {
+  uint32_t x = value ^ prevValue[k];
+  prevValue[k] = value;
+
+  if (x == 0) {
+    putBits(page, bit, 0, 1);
+    return;
+  }
+
+  int lead = __builtin_clz(x);
+  int trail = __builtin_ctz(x);
+
+  if (leading[k] != 0xFF && lead >= leading[k] && trail >= trailing[k]) {
+    putBits(page, bit, 2, 2);
+    putBits(page, bit, x >> trailing[k], 32 - leading[k] - trailing[k]);
+    return;
+  }
+
+  int len = 32 - lead - trail;
+  putBits(page, bit, 3, 2);
+  putBits(page, bit, lead, 5);
+  putBits(page, bit, len - 1, 5);
+  putBits(page, bit, x >> trail, len);
+  leading[k] = lead;
+  trailing[k] = trail;
+}
+
+uint32_t HistoryCodec::decodeValue(const uint8_t * page, uint32_t & bit, int k) {
+  if (getBits(page, bit, 1) == 0)
+    return prevValue[k];
+
+  if (getBits(page, bit, 1) == 0) {
+    int len = 32 - leading[k] - trailing[k];
+    prevValue[k] ^= getBits(page, bit, len) << trailing[k];
+    return prevValue[k];
+  }
+
+  int lead = getBits(page, bit, 5);
+  int len = getBits(page, bit, 5) + 1;
+  int trail = 32 - lead - len;
+  if (trail < 0)
+    trail = 0;
+  prevValue[k] ^= getBits(page, bit, len) << trail;
+  leading[k] = lead;
+  trailing[k] = trail;
+  return prevValue[k];
+}
+
+bool HistoryCodec::encode(uint8_t * page, uint32_t & bit, const HistorySample & sample) {
+  if (HISTORY_PAGE_BITS - bit < HISTORY_MAX_SAMPLE_BITS)
+    return false;
+
+  int32_t delta = sample.time - prevTime;
+  int32_t dod = delta - prevDelta;
+  prevTime = sample.time;
+  prevDelta = delta;
+
+  if (dod == 0) {
+    putBits(page, bit, 0, 1);
+  } else if (dod >= -64 && dod <= 63) {
+    putBits(page, bit, 2, 2);
+    putBits(page, bit, dod, 7);
+  } else if (dod >= -256 && dod <= 255) {
+    putBits(page, bit, 6, 3);
+    putBits(page, bit, dod, 9);
+  } else if (dod >= -2048 && dod <= 2047) {
+    putBits(page, bit, 14, 4);
+    putBits(page, bit, dod, 12);
+  } else {
+    putBits(page, bit, 15, 4);
+    putBits(page, bit, dod, 32);
+  }
+
+  encodeValue(page, bit, 0, sample.temperature);
+  encodeValue(page, bit, 1, sample.humidity);
+  return true;
+}
+
+HistoryDecode HistoryCodec::decode(const uint8_t * page, uint32_t & bit, HistorySample & sample) {
+  if (HISTORY_PAGE_BITS - bit < HISTORY_MAX_SAMPLE_BITS)
+    return HISTORY_PAGE_END;
+
+  uint32_t peek = bit;
+  if (getBits(page, peek, 4) == 15 && getBits(page, peek, 32) == 0xFFFFFFFFUL)
+    return HISTORY_BLOCK_END;
+
+  int32_t dod;
+  if (getBits(page, bit, 1) == 0)
+    dod = 0;
+  else if (getBits(page, bit, 1) == 0)
+    dod = signExtend(getBits(page, bit, 7), 7);
+  else if (getBits(page, bit, 1) == 0)
+    dod = signExtend(getBits(page, bit, 9), 9);
+  else if (getBits(page, bit, 1) == 0)
+    dod = signExtend(getBits(page, bit, 12), 12);
+  else
+    dod = getBits(page, bit, 32);
+
+  prevDelta += dod;
+  prevTime += prevDelta;
+
+  sample.time = prevTime;
+  sample.temperature = decodeValue(page, bit, 0);
+  sample.humidity = decodeValue(page, bit, 1);
+  return HISTORY_SAMPLE;
+}
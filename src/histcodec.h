@@ -0,0 +1,66 @@
+#ifndef HISTCODEC_H
+#define HISTCODEC_H
+
+#include <stdint.h>
+
+/*
+ * Bit format of the long-term history, after the Gorilla time series
+ * encoding: timestamps as delta of delta, values as XOR with the
+ * previous value. Pure code, shared by the firmware (history.cpp) and
+ * host tools.
+ *
+ * A block is one flash sector of a zone: a header page followed by
+ * pages of bitstream. A sample never straddles two pages; the encoder
+ * starts a new page when fewer than HISTORY_MAX_SAMPLE_BITS are left.
+ * Erased flash reads as a '1111' timestamp code with 32 one bits, which
+ * the encoder never produces, so it marks the end of the samples.
+ */
+
+#define HISTORY_PAGE_BITS (256 * 8)
+#define HISTORY_MAX_SAMPLE_BITS (36 + 2 * 44)
+#define HISTORY_NO_VALUE INT32_MIN
+
+/* after FlashPageHeader in the first page of a block */
+typedef struct {
+  uint8_t zone;
+  int8_t program;
+  int8_t segment;
+  uint8_t reserved;
+  uint32_t boot;
+  uint32_t uptime;      /* s at the first sample */
+  uint32_t startTime;   /* s of incubation at the first sample */
+} HistoryBlockHeader;
+
+typedef struct {
+  uint32_t time;        /* s of incubation */
+  int32_t temperature;  /* 1/64 degree */
+  int32_t humidity;     /* 1/8 percent */
+} HistorySample;
+
+enum HistoryDecode {
+  HISTORY_SAMPLE,
+  HISTORY_PAGE_END,
+  HISTORY_BLOCK_END
+};
+
+/* encoder or decoder state of one block */
+class HistoryCodec {
+  public:
+    void begin(uint32_t startTime);
+
+    /* false if the sample does not fit into the rest of the page */
+    bool encode(uint8_t * page, uint32_t & bit, const HistorySample & sample);
+    HistoryDecode decode(const uint8_t * page, uint32_t & bit, HistorySample & sample);
+
+  private:
+    void encodeValue(uint8_t * page, uint32_t & bit, int k, uint32_t value);
+    uint32_t decodeValue(const uint8_t * page, uint32_t & bit, int k);
+
+    uint32_t prevTime;
+    int32_t prevDelta;
+    uint32_t prevValue[2];
+    uint8_t leading[2];
+    uint8_t trailing[2];
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include "history.h"
+
+#include <math.h>
+
+#include "constants.h"
+#include "histcodec.h"
+#include "reply.h"
+#include "zone.h"
+
+#define BLOCK_PAGES (HISTORY_BLOCK_SIZE / FLASH_PAGE_SIZE)
+
+/* the block a zone is writing; seq 0 while none is open */
+typedef struct {
+  uint32_t seq;
+  int program;
+  int segment;
+  uint32_t page;
+  uint32_t bit;
+  HistoryCodec codec;
+  uint8_t staging[FLASH_PAGE_SIZE];
+} OpenBlock;
+
+HistoryStats historyStats;
+FlashRing historyRing;
+
+static OpenBlock blocks[N_ZONES];
+static uint32_t lastSample;
+/* the sample in progress, zone by zone; N_ZONES when none */
+static uint32_t sampleTime;
+static int sampleZone = N_ZONES;
+
+static int32_t quantize(float value, float scale) {
+  if (isnan(value))
+    return HISTORY_NO_VALUE;
+  return lroundf(value * scale);
+}
+
+static bool readHeader(uint32_t seq, HistoryBlockHeader & header) {
+  return historyRing.read(seq, sizeof(FlashPageHeader), &header, sizeof(header));
+}
+
+void historyBegin() {
+  HistoryBlockHeader header;
+
+  historyRing.begin(HISTORY_FLASH_TOP, HISTORY_FLASH_SIZE, HISTORY_MAGIC,
+                    HISTORY_BLOCK_SIZE);
+
+  historyStats.boot = 1;
+  if (historyRing.next() != historyRing.first()
+      && readHeader(historyRing.next() - 1, header))
+    historyStats.boot = header.boot + 1;
+
+  for (int i = 0; i < N_ZONES; i++)
+    blocks[i].seq = 0;
+  lastSample = millis();
+}
+
+/* writes the page being filled and starts the next one */
+static void programPage(OpenBlock & block) {
+  if (historyRing.program(block.seq, block.page * FLASH_PAGE_SIZE, block.staging))
+    historyStats.pages++;
+  memset(block.staging, 0xFF, sizeof(block.staging));
+  block.page++;
+  block.bit = 0;
+}
+
+static bool openBlock(OpenBlock & block, int zone, const HistorySample & sample) {
+  uint8_t payload[FLASH_RING_PAYLOAD];
+  HistoryBlockHeader header;
+
+  header.zone = zone;
+  header.program = zones[zone].currentProgramNumber;
+  header.segment = zones[zone].currentSegment;
+  header.reserved = 0xFF;
+  header.boot = historyStats.boot;
+  header.uptime = millis() / 1000;
+  header.startTime = sample.time;
+
+  memset(payload, 0xFF, sizeof(payload));
+  memcpy(payload, &header, sizeof(header));
+
+  block.seq = historyRing.open(payload);
+  if (!block.seq)
+    return false;
+
+  block.program = zones[zone].currentProgramNumber;
+  block.segment = zones[zone].currentSegment;
+  block.page = 1;
+  block.bit = 0;
+  block.codec.begin(sample.time);
+  memset(block.staging, 0xFF, sizeof(block.staging));
+  historyStats.blocks++;
+  return true;
+}
+
+/* false if the zone's next block waits for an erase in a later pass */
+static bool record(int zone, const HistorySample & sample) {
+  OpenBlock & block = blocks[zone];
+
+  /* a program or segment change starts a new block */
+  if (block.seq && (block.program != zones[zone].currentProgramNumber
+                    || block.segment != zones[zone].currentSegment)) {
+    if (block.bit > 0)
+      programPage(block);
+    block.seq = 0;
+  }
+
+  if (!block.seq) {
+    if (!historyRing.writable())
+      return false;
+    if (!openBlock(block, zone, sample))
+      return true;
+  }
+
+  if (!block.codec.encode(block.staging, block.bit, sample)) {
+    programPage(block);
+    if (block.page == BLOCK_PAGES) {
+      block.seq = 0;
+      if (!historyRing.writable())
+        return false;
+      if (!openBlock(block, zone, sample))
+        return true;
+    }
+    block.codec.encode(block.staging, block.bit, sample);
+  }
+  historyStats.samples++;
+  return true;
+}
+
+void historyService() {
+  uint32_t now = millis();
+
+  if (!historyRing.ready)
+    return;
+
+  if (sampleZone == N_ZONES) {
+    if ((now - lastSample) < HISTORY_PERIOD)
+      return;
+    lastSample += HISTORY_PERIOD;
+    if ((now - lastSample) >= HISTORY_PERIOD)
+      lastSample = now;
+    sampleTime = now;
+    sampleZone = 0;
+  }
+
+  /* every block is a sector: one zone per pass may start one */
+  for (; sampleZone < N_ZONES; sampleZone++) {
+    int i = sampleZone;
+    HistorySample sample;
+    sample.time = (sampleTime - zones[i].beginTimer) / 1000;
+    float temperature = zones[i].currentTemperature;
+    if (temperature == TEMP_ERROR)
+      temperature = NAN;
+    sample.temperature = quantize(temperature, 64);
+    sample.humidity = quantize(zones[i].currentHumidity, 8);
+    if (!record(i, sample))
+      return;
+  }
+}
+
+bool historyRead(uint32_t seq, uint32_t offset, uint8_t * data, uint32_t len) {
+  if (!historyRing.read(seq, offset, data, len))
+    return false;
+
+  for (int i = 0; i < N_ZONES; i++) {
+    const OpenBlock & block = blocks[i];
+    uint32_t start = block.page * FLASH_PAGE_SIZE;
+
+    if (block.seq != seq)
+      continue;
+
+    uint32_t lo = (offset > start) ? offset : start;
+    uint32_t hi = (offset + len < start + FLASH_PAGE_SIZE)
+      ? offset + len : start + FLASH_PAGE_SIZE;
+    if (lo < hi)
+      memcpy(data + lo - offset, block.staging + lo - start, hi - lo);
+  }
+  return true;
+}
+
+void historyPrintIndex(Print & out, uint32_t seq, int n) {
+  HistoryBlockHeader header;
+
+  if ((int32_t)(seq - historyRing.first()) < 0)
+    seq = historyRing.first();
+
+  for (; n > 0 && seq != historyRing.next(); n--, seq++) {
+    if (!readHeader(seq, header)) {
+      printFormat(out, "no_block %lu\r\n", (unsigned long)seq);
+      continue;
+    }
+    printFormat(out, "block %lu %d %d %d %lu %lu %lu\r\n",
+      (unsigned long)seq, header.zone, header.program, header.segment,
+      (unsigned long)header.boot, (unsigned long)header.uptime,
+      (unsigned long)header.startTime);
+  }
+}
+
+/* decodes a block page by page; false when the rows ran out */
+static bool printBlock(Print & out, uint32_t seq, const HistoryBlockHeader & header,
+                       uint32_t from, uint32_t to, uint32_t skip, int & rows)
+{
+  static uint8_t page[FLASH_PAGE_SIZE];
+  HistoryCodec codec;
+  HistorySample sample;
+  uint32_t index = 0;
+
+  codec.begin(header.startTime);
+  for (uint32_t p = 1; p < BLOCK_PAGES; p++) {
+    HistoryDecode result;
+    uint32_t bit = 0;
+
+    if (!historyRead(seq, p * FLASH_PAGE_SIZE, page, sizeof(page)))
+      return true;
+
+    while ((result = codec.decode(page, bit, sample)) == HISTORY_SAMPLE) {
+      if (index++ < skip || sample.time < from)
+        continue;
+      if (sample.time > to)
+        return true;
+      if (rows == 0) {
+        printFormat(out, "cursor %lu:%lu\r\n",
+          (unsigned long)seq, (unsigned long)(index - 1));
+        return false;
+      }
+      rows--;
+      printFormat(out, "sample %lu %.3f %.3f\r\n",
+        (unsigned long)sample.time,
+        (sample.temperature == HISTORY_NO_VALUE)
+          ? NAN : sample.temperature / 64.0,
+        (sample.humidity == HISTORY_NO_VALUE) ? NAN : sample.humidity / 8.0);
+    }
+    if (result == HISTORY_BLOCK_END)
+      break;
+  }
+  return true;
+}
+
+void historyPrintRange(Print & out, int zone, uint32_t from, uint32_t to,
+                       uint32_t seq, uint32_t skip)
+{
+  HistoryBlockHeader header, pending;
+  uint32_t pendingSeq = 0;
+  uint32_t cursor = seq;
+  int rows = HISTORY_READ_ROWS;
+
+  if ((int32_t)(seq - historyRing.first()) < 0)
+    seq = historyRing.first();
+
+  for (; seq != historyRing.next(); seq++) {
+    if (!readHeader(seq, header) || header.zone != zone)
+      continue;
+
+    if (pendingSeq) {
+      /* the block before ends where this one starts */
+      bool before = header.boot == pending.boot && header.startTime <= from;
+      if (!before && !printBlock(out, pendingSeq, pending, from, to,
+                                 (pendingSeq == cursor) ? skip : 0, rows))
+        return;
+      pendingSeq = 0;
+    }
+
+    if (header.startTime <= to) {
+      pending = header;
+      pendingSeq = seq;
+    }
+  }
+
+  if (pendingSeq && !printBlock(out, pendingSeq, pending, from, to,
+                                (pendingSeq == cursor) ? skip : 0, rows))
+    return;
+  out.print("end\r\n");
+}
@@ -0,0 +1,40 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+
+#include "flashring.h"
+
+/*
+ * Long-term log of the temperature and humidity of every zone, one
+ * sample per HISTORY_PERIOD, compressed (histcodec.h) into 4 KB blocks
+ * of a flash ring. A block holds one zone in one program segment and
+ * decodes without the others; its header page is the index. The page
+ * being filled stays in RAM until it is full, so a reset loses at most
+ * that page.
+ */
+
+typedef struct {
+  uint32_t boot;
+  uint32_t samples;
+  uint32_t blocks;
+  uint32_t pages;
+} HistoryStats;
+
+extern HistoryStats historyStats;
+extern FlashRing historyRing;
+
+void historyBegin();
+void historyService();
+
+/* part of a block; the page being filled comes from RAM */
+bool historyRead(uint32_t seq, uint32_t offset, uint8_t * data, uint32_t len);
+
+/* "block" lines of the headers from seq on */
+void historyPrintIndex(Print & out, uint32_t seq, int n);
+/* "sample" lines of a zone between from and to s of incubation, then
+   "end" or the "cursor" to continue from */
+void historyPrintRange(Print & out, int zone, uint32_t from, uint32_t to,
+                       uint32_t seq, uint32_t skip);
+
+#endif
@@ -0,0 +1,370 @@
+#include "http.h"
+
+#include <WiFiNINA.h>
+#include <string.h>
+#include <strings.h>
+
+#include "constants.h"
+#include "control.h"
+#include "metrics.h"
+#include "pages.h"
+#include "reply.h"
+
+enum HTTPMethod {
+  METHOD_GET = 1,
+  METHOD_POST,
+  INCORRECT_METHOD = 255
+};
+
+/* responses that take more than one slice to send */
+enum Sending {
+  SEND_NONE = 0,
+  SEND_ASSET,
+  SEND_METRICS,
+  SEND_REJECT
+};
+
+/* the request being served, carried over loop() passes */
+typedef struct {
+  WiFiClient client;
+  bool active;
+  uint32_t timer;       /* start of the request, or last progress of a reply */
+  size_t len;
+  int method;
+  int nLine;
+  bool receivingCommands;
+  long contentLength;   /* -1 without the header */
+  long bodyRead;
+  uint32_t lastData;
+  uint8_t etagMatched;  /* ETAG_ bits of If-None-Match */
+  bool acceptGzip;
+  Session session;
+  int sending;
+  const Response * response;
+  size_t sent;
+  int part;
+} Connection;
+
+typedef struct {
+  uint32_t ip;
+  float tokens;
+  uint32_t last;
+} RateBucket;
+
+NetStats netStats;
+
+static WiFiServer http(80);
+
+static Connection conn;
+static RateBucket buckets[NET_RATE_CLIENTS];
+
+static char line[MAX_CMD_LENGTH + 1];
+static char address[MAX_ARG_LENGTH + 1];
+static char answerBuf[ANSWER_SIZE];
+static uint8_t readBuf[NET_READ_CHUNK];
+
+static ReplyBuffer answer(answerBuf, sizeof(answerBuf));
+/* the part of /metrics in answer, being sent */
+static Response metricsPart;
+
+static uint32_t lastPass = 0;
+
+static bool startsWith(const char * s, const char * prefix) {
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* header names are case-insensitive */
+static bool isHeader(const char * s, const char * name) {
+  return strncasecmp(s, name, strlen(name)) == 0;
+}
+
+/* "GET /path HTTP/1.1": returns the method, copies the path */
+static int parseRequestLine(const char * s) {
+  const char * sp = strchr(s, ' ');
+  int method;
+
+  if (sp && (size_t)(sp - s) == 3 && startsWith(s, "GET"))
+    method = METHOD_GET;
+  else if (sp && (size_t)(sp - s) == 4 && startsWith(s, "POST"))
+    method = METHOD_POST;
+  else
+    method = INCORRECT_METHOD;
+
+  address[0] = '\0';
+  if (sp) {
+    const char * path = sp + 1;
+    const char * end = strchr(path, ' ');
+    size_t n = end ? (size_t)(end - path) : strlen(path);
+    if (n > MAX_ARG_LENGTH)
+      n = MAX_ARG_LENGTH;
+    memcpy(address, path, n);
+    address[n] = '\0';
+  }
+
+  return method;
+}
+
+/* token bucket per client address; unknown clients take the oldest slot */
+static bool rateAllow(uint32_t ip, uint32_t now) {
+  RateBucket * bucket = &buckets[0];
+
+  for (int i = 0; i < NET_RATE_CLIENTS; i++) {
+    if (buckets[i].ip == ip) {
+      bucket = &buckets[i];
+      break;
+    }
+    if ((now - buckets[i].last) > (now - bucket->last))
+      bucket = &buckets[i];
+  }
+
+  if (bucket->ip != ip) {
+    bucket->ip = ip;
+    bucket->tokens = NET_RATE_BURST;
+  } else {
+    bucket->tokens += (now - bucket->last) * NET_RATE / 1000.0F;
+    if (bucket->tokens > NET_RATE_BURST)
+      bucket->tokens = NET_RATE_BURST;
+  }
+  bucket->last = now;
+
+  if (bucket->tokens < 1)
+    return false;
+  bucket->tokens -= 1;
+  return true;
+}
+
+static void closeConnection() {
+  conn.client.stop();
+  conn.active = false;
+}
+
+/* queued like an asset, so a slow client cannot hold up loop() */
+static void reject(WiFiClient & client, int code) {
+  conn.client = client;
+  conn.active = true;
+  conn.timer = millis();
+  conn.sending = SEND_REJECT;
+  conn.response = busyResponse(code);
+  conn.sent = 0;
+}
+
+static void finishCommands() {
+  if (conn.len > 0) {
+    line[conn.len] = '\0';
+    processCommand(line, conn.session, answer);
+  }
+  endSession(conn.session, answer);
+  answer.endReply();
+  sendPage(conn.client, HTTP_200_OK, "text/plain", answer.c_str());
+  netStats.served++;
+  closeConnection();
+}
+
+static void handleLine() {
+  line[conn.len] = '\0';
+
+  if (conn.receivingCommands) {
+    processCommand(line, conn.session, answer);
+  } else if (conn.nLine == 0) {
+    conn.method = parseRequestLine(line);
+  } else if (conn.len > 0) {
+    const char * value = strchr(line, ':');
+    value = value ? value + 1 : line + conn.len;
+    while (*value == ' ')
+      value++;
+    if (isHeader(line, "If-None-Match:"))
+      conn.etagMatched = etagMatches(findAsset(address), value);
+    else if (isHeader(line, "Accept-Encoding:"))
+      conn.acceptGzip = strstr(value, "gzip") != NULL;
+    else if (isHeader(line, "Content-Length:"))
+      conn.contentLength = atol(value);
+  } else if (strcmp(address, "/control") == 0) {
+    if (conn.method == METHOD_GET) {
+      sendPage(conn.client, HTTP_200_OK, "text/plain", "method_get");
+      netStats.served++;
+      closeConnection();
+    } else if (conn.method == METHOD_POST) {
+      conn.receivingCommands = true;
+      conn.lastData = millis();
+      if (conn.contentLength == 0)
+        finishCommands();
+    }
+  } else if (strcmp(address, "/metrics") == 0 && conn.method == METHOD_GET) {
+    answer.clear();
+    sendStreamHeader(answer, HTTP_200_OK, "text/plain; version=0.0.4");
+    metricsPart.data = (const uint8_t *)answer.c_str();
+    metricsPart.len = answer.length();
+    conn.response = &metricsPart;
+    conn.sending = SEND_METRICS;
+    conn.sent = 0;
+    conn.part = 0;
+    conn.timer = millis();
+  } else {
+    conn.response = assetResponse(findAsset(address), conn.etagMatched,
+                                  conn.acceptGzip);
+    conn.sending = SEND_ASSET;
+    conn.sent = 0;
+    conn.timer = millis();
+  }
+
+  conn.len = 0;
+  conn.nLine++;
+}
+
+static void accept() {
+  WiFiClient client = http.available();
+
+  if (!client)
+    return;
+
+  if (netStats.load > NET_SHED_LOAD) {
+    netStats.shed++;
+    reject(client, HTTP_503_SERVICE_UNAVAILABLE);
+    return;
+  }
+  if (!rateAllow(client.remoteIP(), millis())) {
+    netStats.rateLimited++;
+    reject(client, HTTP_429_TOO_MANY_REQUESTS);
+    return;
+  }
+
+  netStats.accepted++;
+  conn.client = client;
+  conn.active = true;
+  conn.timer = millis();
+  conn.len = 0;
+  conn.method = 0;
+  conn.nLine = 0;
+  conn.receivingCommands = false;
+  conn.contentLength = -1;
+  conn.bodyRead = 0;
+  conn.sending = SEND_NONE;
+  conn.etagMatched = 0;
+  conn.acceptGzip = false;
+  beginSession(conn.session);
+  answer.clear();
+  address[0] = '\0';
+}
+
+/*
+ * Sends the next piece of a long reply; false once it is all out.
+ * The client may take less than offered: the rest goes on the next
+ * call, and a client that takes nothing is ended by the timeout.
+ * /metrics is printed into answer one part at a time.
+ */
+static bool sendMore() {
+  if (conn.sending == SEND_METRICS && conn.sent == metricsPart.len) {
+    answer.clear();
+    if (!writeMetrics(answer, conn.part++))
+      return false;
+    metricsPart.len = answer.length();
+    conn.sent = 0;
+  }
+
+  size_t n = conn.response->len - conn.sent;
+  if (n > NET_WRITE_CHUNK)
+    n = NET_WRITE_CHUNK;
+  if (n > 0)
+    conn.sent += conn.client.write(conn.response->data + conn.sent, n);
+  return conn.sent < conn.response->len || conn.sending == SEND_METRICS;
+}
+
+/*
+ * A body with Content-Length ends when that much has arrived; one
+ * without ends when the client closes its side or goes quiet.
+ */
+static bool bodyEnded() {
+  if (conn.contentLength >= 0)
+    return false;
+  return !conn.client.connected() || (millis() - conn.lastData) >= NET_BODY_IDLE;
+}
+
+/* reads and handles what has arrived, until the slice runs out */
+static bool serve(uint32_t sliceStart) {
+  while ((micros() - sliceStart) < NET_SLICE_US) {
+    if ((millis() - conn.timer) >= REQUEST_TIMEOUT) {
+      netStats.timeouts++;
+      closeConnection();
+      return true;
+    }
+
+    if (conn.sending != SEND_NONE) {
+      size_t sent = conn.sent;
+      int part = conn.part;
+      if (!sendMore()) {
+        if (conn.sending != SEND_REJECT)
+          netStats.served++;
+        closeConnection();
+        return true;
+      }
+      if (conn.sent != sent || conn.part != part)
+        conn.timer = millis();
+      continue;
+    }
+
+    int n = conn.client.available();
+    if (n <= 0) {
+      if (conn.receivingCommands && bodyEnded())
+        finishCommands();
+      else if (!conn.client.connected())
+        closeConnection();
+      return true;
+    }
+
+    if (n > (int)sizeof(readBuf))
+      n = sizeof(readBuf);
+    n = conn.client.read(readBuf, n);
+    if (n <= 0)
+      return true;
+    netStats.bytesIn += n;
+    conn.lastData = millis();
+
+    for (int i = 0; i < n && conn.active && conn.sending == SEND_NONE; i++) {
+      char c = readBuf[i];
+      bool body = conn.receivingCommands;
+
+      if (body)
+        conn.bodyRead++;
+      if (c == '\n') {
+        handleLine();
+      } else if (c != '\r' && conn.len < MAX_CMD_LENGTH) {
+        /* overlong lines are truncated */
+        line[conn.len++] = c;
+      }
+      if (body && conn.bodyRead == conn.contentLength)
+        finishCommands();
+    }
+
+    if (!conn.active)
+      return true;
+  }
+
+  return false;
+}
+
+void httpBegin() {
+  http.begin();
+  lastPass = micros();
+}
+
+void handleRequest() {
+  uint32_t start = micros();
+
+  if (!conn.active)
+    accept();
+
+  if (conn.active && !serve(start))
+    netStats.slicesExhausted++;
+
+  uint32_t now = micros();
+  uint32_t spent = now - start;
+  if (spent > netStats.maxSliceUs)
+    netStats.maxSliceUs = spent;
+
+  /* share of the loop() time spent here */
+  if (now != lastPass) {
+    float load = (float)spent / (now - lastPass);
+    netStats.load += NET_LOAD_ALPHA * (load - netStats.load);
+  }
+  lastPass = now;
+}
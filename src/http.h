@@ -0,0 +1,31 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <Arduino.h>
+
+/*
+ * HTTP service of the soft-AP. handleRequest() is called once per loop()
+ * pass and returns after NET_SLICE_US at most; a request that is not
+ * complete by then is continued on the next pass. Clients over their
+ * rate get a 429, new connections while the network eats more than
+ * NET_SHED_LOAD of the loop get an early 503.
+ */
+
+typedef struct {
+  uint32_t accepted;
+  uint32_t served;
+  uint32_t rateLimited;
+  uint32_t shed;
+  uint32_t timeouts;
+  uint32_t bytesIn;
+  uint32_t slicesExhausted;
+  uint32_t maxSliceUs;
+  float load;
+} NetStats;
+
+extern NetStats netStats;
+
+void httpBegin();
+void handleRequest();
+
+#endif
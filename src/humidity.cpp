@@ -0,0 +1,121 @@
+#include "humidity.h"
+
+#include <math.h>
+
+#include "constants.h"
+
+static float clampf(float value, float low, float high) {
+  return (value < low) ? low : ((value > high) ? high : value);
+}
+
+void HumidityController::begin(uint32_t now) {
+  state = HUMID_IDLE;
+
+  gain = HUMID_INITIAL_GAIN;
+  lossRate = 0;
+
+  pulseLength = 0;
+  pulses = 0;
+  onTime = 0;
+  duty = 0;
+
+  stateTimer = now;
+  startHumidity = 0;
+
+  lossHumidity = NAN;
+  lossTimer = now;
+
+  dutyTimer = now;
+  dutyOnTime = 0;
+  lastUpdate = now;
+}
+
+void HumidityController::account(uint32_t now) {
+  if (state == HUMID_WETTING) {
+    onTime += now - lastUpdate;
+    dutyOnTime += now - lastUpdate;
+  }
+  lastUpdate = now;
+
+  if ((now - dutyTimer) >= HUMID_DUTY_WINDOW) {
+    duty = (float)dutyOnTime / (now - dutyTimer);
+    dutyOnTime = 0;
+    dutyTimer = now;
+  }
+}
+
+/* called once the DHT22 has settled after a pulse */
+void HumidityController::learn(float humidity, uint32_t now) {
+  float elapsed = (pulseLength + HUMID_SETTLE_TIME) / 1000.0F;
+  float rise = (humidity - startHumidity) - lossRate * elapsed;
+  float sample = rise / (pulseLength / 1000.0F);
+
+  sample = clampf(sample, HUMID_MIN_GAIN, HUMID_MAX_GAIN);
+  gain += HUMID_LEARN_RATE * (sample - gain);
+
+  lossHumidity = humidity;
+  lossTimer = now;
+}
+
+bool HumidityController::update(float humidity, float needed, uint32_t now) {
+  account(now);
+
+  if (isnan(humidity)) {
+    if (state != HUMID_IDLE) {
+      state = HUMID_IDLE;
+      stateTimer = now;
+    }
+    lossHumidity = NAN;
+    return false;
+  }
+
+  switch (state) {
+    case HUMID_WETTING: {
+      if ((now - stateTimer) < pulseLength)
+        return true;
+      state = HUMID_SETTLING;
+      stateTimer = now;
+      return false;
+    }
+    case HUMID_SETTLING: {
+      if ((now - stateTimer) >= HUMID_SETTLE_TIME) {
+        learn(humidity, now);
+        state = HUMID_IDLE;
+      }
+      return false;
+    }
+    case HUMID_IDLE:
+      break;
+  }
+
+  /* how fast the chamber dries out without the wetter */
+  if (isnan(lossHumidity)) {
+    lossHumidity = humidity;
+    lossTimer = now;
+  } else if ((now - lossTimer) >= HUMID_LOSS_PERIOD) {
+    float rate = (humidity - lossHumidity) * 1000.0F / (now - lossTimer);
+    lossRate += HUMID_LEARN_RATE * (rate - lossRate);
+    lossHumidity = humidity;
+    lossTimer = now;
+  }
+
+  if ((now - stateTimer) < MIN_WET_OFF_TIME)
+    return false;
+
+  float error = needed - humidity;
+  if (error <= HUMIDITY_DEADBAND)
+    return false;
+
+  /*
+   * aim at the upper edge of the deadband, but undershoot on purpose:
+   * the DHT22 only sees the result a minute later
+   */
+  float pulse = (error + HUMIDITY_DEADBAND) * HUMID_PULSE_FRACTION / gain * 1000.0F;
+  pulseLength = (uint32_t)clampf(pulse, MIN_WET_PULSE, MAX_WET_PULSE);
+  pulses++;
+
+  startHumidity = humidity;
+  state = HUMID_WETTING;
+  stateTimer = now;
+  return true;
+}
@@ -0,0 +1,49 @@
+#ifndef HUMIDITY_H
+#define HUMIDITY_H
+
+#include <stdint.h>
+
+/*
+ * Adaptive wetter control. Learns how much one second of wetting raises
+ * the humidity of the chamber (gain) and how fast it dries out on its
+ * own (loss), then sizes every pulse to close the humidity error. After
+ * a pulse it waits for the slow DHT22 to settle before judging it.
+ */
+
+enum HumidState {
+  HUMID_IDLE,
+  HUMID_WETTING,
+  HUMID_SETTLING
+};
+
+class HumidityController {
+  public:
+    void begin(uint32_t now);
+    bool update(float humidity, float needed, uint32_t now);
+
+    HumidState state;
+
+    float gain;
+    float lossRate;
+
+    uint32_t pulseLength;
+    uint32_t pulses;
+    uint32_t onTime;
+    float duty;
+
+  private:
+    void learn(float humidity, uint32_t now);
+    void account(uint32_t now);
+
+    uint32_t stateTimer;
+    float startHumidity;
+
+    float lossHumidity;
+    uint32_t lossTimer;
+
+    uint32_t dutyTimer;
+    uint32_t dutyOnTime;
+    uint32_t lastUpdate;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "memory.h"
+
+#include <stdio.h>
+
+HeapStats heapStats;
+
+#ifdef HEAP_FREE
+
+#include <reent.h>
+
+extern "C" {
+  void * __real__malloc_r(struct _reent * r, size_t size);
+  void * __real__calloc_r(struct _reent * r, size_t n, size_t size);
+  void * __real__realloc_r(struct _reent * r, void * ptr, size_t size);
+}
+
+static void checkAllocation(size_t size, void * caller) {
+  if (!heapStats.locked)
+    return;
+
+  heapStats.violations++;
+  heapStats.lastSize = size;
+  heapStats.lastCaller = (uint32_t)(uintptr_t)caller;
+}
+
+/*
+ * newlib's malloc() is _malloc_r(_REENT, ...), which is wrapped too.
+ * The plain entry points go to the real _r functions directly, so an
+ * allocation is counted once and with the caller of malloc().
+ */
+extern "C" void * __wrap_malloc(size_t size) {
+  checkAllocation(size, __builtin_return_address(0));
+  return __real__malloc_r(_REENT, size);
+}
+
+extern "C" void * __wrap_calloc(size_t n, size_t size) {
+  checkAllocation(n * size, __builtin_return_address(0));
+  return __real__calloc_r(_REENT, n, size);
+}
+
+extern "C" void * __wrap_realloc(void * ptr, size_t size) {
+  checkAllocation(size, __builtin_return_address(0));
+  return __real__realloc_r(_REENT, ptr, size);
+}
+
+extern "C" void * __wrap__malloc_r(struct _reent * r, size_t size) {
+  checkAllocation(size, __builtin_return_address(0));
+  return __real__malloc_r(r, size);
+}
+
+extern "C" void * __wrap__calloc_r(struct _reent * r, size_t n, size_t size) {
+  checkAllocation(n * size, __builtin_return_address(0));
+  return __real__calloc_r(r, n, size);
+}
+
+extern "C" void * __wrap__realloc_r(struct _reent * r, void * ptr, size_t size) {
+  checkAllocation(size, __builtin_return_address(0));
+  return __real__realloc_r(r, ptr, size);
+}
+
+#endif
+
+void heapLock() {
+  char buf[32];
+
+  /* newlib allocates its float conversion buffers on first use */
+  snprintf(buf, sizeof(buf), "%.2f %.4f", 1.0, 0.5);
+
+  heapStats.locked = true;
+}
@@ -0,0 +1,25 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <Arduino.h>
+
+/*
+ * Heap guard of the HEAP_FREE build. The linker wraps malloc() and
+ * friends (see platformio.ini); once heapLock() is called at the end
+ * of setup() every allocation is counted as a violation. Violations
+ * show in request_memory and /metrics only; the watchdog's crash
+ * record is left to the stall it may have to explain.
+ */
+
+typedef struct {
+  bool locked;
+  uint32_t violations;
+  uint32_t lastSize;
+  uint32_t lastCaller;
+} HeapStats;
+
+extern HeapStats heapStats;
+
+void heapLock();
+
+#endif
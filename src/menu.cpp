@@ -0,0 +1,296 @@
+#include "menu.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "automode.h"
+#include "constants.h"
+#include "zone.h"
+
+int selectedZone = 0;
+
+static int newProgramNumber;
+
+static LiquidCrystal_I2C * display;
+
+static Frame shown;
+static int current = 0;
+static bool needUpdate = true;
+static uint32_t updateTimer = 0;
+static uint32_t menuSwitchTimer = 0;
+
+static Zone & zone() {
+  return zones[selectedZone];
+}
+
+static void putText(Frame frame, int row, int col, const char * text) {
+  for (; *text && col < LCD_COLS; col++)
+    frame[row][col] = *text++;
+}
+
+static char positionChar(Position pos) {
+  switch (pos) {
+    case M: return '-';
+    case N: return '0';
+    case P: return '+';
+    case Undefined: return '?';
+    case PosError: return 'E';
+  }
+  return ' ';
+}
+
+/* setters */
+
+static bool handMode() {
+  return zone().currentProgramNumber == handProgram;
+}
+
+static void markChanged() {
+  zone().hasChanges = true;
+}
+
+static float getTemperature() { return zone().config().neededTemperature; }
+static float getHumidity() { return zone().config().neededHumidity; }
+static float getRotations() { return zone().config().rotationsPerDay; }
+static float getProgram() { return newProgramNumber; }
+static float getZone() { return selectedZone + 1; }
+
+static void setTemperature(float value) {
+  ZoneConfig next = zone().config();
+  next.neededTemperature = value;
+  zone().commitConfig(next);
+}
+
+static void setHumidity(float value) {
+  ZoneConfig next = zone().config();
+  next.neededHumidity = value;
+  zone().commitConfig(next);
+}
+
+static void setRotations(float value) {
+  ZoneConfig next = zone().config();
+  next.rotationsPerDay = (int)value;
+  zone().commitConfig(next);
+}
+
+static void setProgram(float value) { newProgramNumber = (int)value; }
+static void setZone(float value) { selectedZone = (int)value - 1; }
+
+static void enterProgram() { newProgramNumber = zone().currentProgramNumber; }
+static void leaveProgram() { zone().loadProgram(newProgramNumber); }
+
+/* formatters */
+
+static void fmtTemperature(char * buf, size_t size, float value) {
+  snprintf(buf, size, "%2.1f\xDF", value);
+}
+
+static void fmtPercent(char * buf, size_t size, float value) {
+  snprintf(buf, size, "%d%%", (int)value);
+}
+
+static void fmtInt(char * buf, size_t size, float value) {
+  snprintf(buf, size, "%d", (int)value);
+}
+
+static void fmtProgram(char * buf, size_t size, float value) {
+  snprintf(buf, size, "P%d", (int)value);
+}
+
+/* views */
+
+// Vsö! Objavläjem latinizacyju!
+static void drawCurrent(Frame frame) {
+  char buf[LCD_COLS + 1];
+
+  snprintf(buf, sizeof(buf), "  Temp %2.1f\xDF", zone().currentTemperature);
+  putText(frame, 0, 0, buf);
+  snprintf(buf, sizeof(buf), "  Vla\1 %3d%%", (int)zone().currentHumidity);
+  putText(frame, 1, 0, buf);
+
+  frame[0][15] = positionChar(zone().pos);
+  if (zone().rotateTo == M || zone().rotateTo == N || zone().rotateTo == P)
+    frame[1][15] = positionChar(zone().rotateTo);
+}
+
+static void drawManualRotation(Frame frame) {
+  putText(frame, 0, 0, "Ru\2noj povorot");
+  putText(frame, 1, 0, "jajic");
+  frame[0][15] = positionChar(zone().pos);
+}
+
+static void inputManualRotation(const MenuInput & in) {
+  if (in.plus)
+    zone().rotateRight();
+  else if (in.minus)
+    zone().rotateLeft();
+  if (in.released)
+    zone().rotateOff();
+  if (in.plus || in.minus)
+    markChanged();
+  if (in.plusHeld || in.minusHeld)
+    needUpdate = true;
+}
+
+/*
+ * The menu, in the order the menu button walks through it. Value items
+ * with min == max have nothing to choose and are skipped.
+ */
+static constexpr MenuItem MENU[] = {
+  {
+    "", NULL, NULL, 0, 0, 0, NULL, NULL,
+    NULL, NULL, NULL,
+    drawCurrent, NULL
+  },
+  {
+    "Zona", getZone, setZone, 1, N_ZONES, 1, fmtInt, NULL,
+    NULL, NULL, NULL,
+    NULL, NULL
+  },
+  {
+    "Temperatura", getTemperature, setTemperature,
+    MIN_TEMPERATURE, MAX_TEMPERATURE, DELTA_TEMPERATURE, fmtTemperature, handMode,
+    markChanged, NULL, NULL,
+    NULL, NULL
+  },
+  {
+    "Vla\1nostj", getHumidity, setHumidity,
+    MIN_HUMIDITY, MAX_HUMIDITY, DELTA_HUMIDITY, fmtPercent, handMode,
+    markChanged, NULL, NULL,
+    NULL, NULL
+  },
+  {
+    "Kol-vo povorotov", getRotations, setRotations,
+    MIN_ROT_PER_DAY, MAX_ROT_PER_DAY, DELTA_ROT_PER_DAY, fmtInt, handMode,
+    markChanged, NULL, NULL,
+    NULL, NULL
+  },
+  {
+    "Re\1ym", getProgram, setProgram,
+    0, N_PROGRAMS - 1, 1, fmtProgram, NULL,
+    markChanged, enterProgram, leaveProgram,
+    NULL, NULL
+  },
+  {
+    "", NULL, NULL, 0, 0, 0, NULL, NULL,
+    NULL, NULL, NULL,
+    drawManualRotation, inputManualRotation
+  }
+};
+
+#define N_MENU_ITEMS ((int)(sizeof(MENU) / sizeof(MENU[0])))
+
+static bool skipped(const MenuItem & item) {
+  return item.get && item.min >= item.max;
+}
+
+static void draw(const MenuItem & item, Frame frame) {
+  for (int row = 0; row < LCD_ROWS; row++) {
+    memset(frame[row], ' ', LCD_COLS);
+    frame[row][LCD_COLS] = '\0';
+  }
+
+  if (item.draw) {
+    item.draw(frame);
+    return;
+  }
+
+  char buf[LCD_COLS + 1];
+  item.format(buf, sizeof(buf), item.get());
+  putText(frame, 0, 0, item.label);
+  putText(frame, 1, 0, buf);
+}
+
+/* sends only the changed span of every row */
+static void flush(const Frame frame) {
+  for (int row = 0; row < LCD_ROWS; row++) {
+    int first = 0, last = LCD_COLS - 1;
+    while (first < LCD_COLS && frame[row][first] == shown[row][first])
+      first++;
+    if (first == LCD_COLS)
+      continue;
+    while (frame[row][last] == shown[row][last])
+      last--;
+
+    display->setCursor(first, row);
+    for (int col = first; col <= last; col++) {
+      display->write(frame[row][col]);
+      shown[row][col] = frame[row][col];
+    }
+  }
+}
+
+static void handleValue(const MenuItem & item, const MenuInput & in) {
+  if (!in.plus && !in.minus)
+    return;
+  if (item.editable && !item.editable())
+    return;
+
+  float value = item.get() + (in.plus ? item.step : -item.step);
+  value = roundf(value / item.step) * item.step;
+  if (value < item.min)
+    value = item.min;
+  if (value > item.max)
+    value = item.max;
+
+  item.set(value);
+  if (item.onChange)
+    item.onChange();
+}
+
+void menuBegin(LiquidCrystal_I2C * lcd) {
+  display = lcd;
+  menuInvalidate();
+}
+
+/* forgets what is on the display, so the next update redraws it all */
+void menuInvalidate() {
+  memset(shown, 0, sizeof(shown));
+  needUpdate = true;
+}
+
+void menuUpdate(const MenuInput & in) {
+  if (in.menu || in.plus || in.minus) {
+    needUpdate = true;
+    menuSwitchTimer = millis();
+  }
+
+  if (menuSwitchTimer && (millis() - menuSwitchTimer) >= MENU_SWITCH_PERIOD) {
+    current = 0;
+    needUpdate = true;
+    menuSwitchTimer = 0;
+  }
+
+  if (in.menu) {
+    if (MENU[current].onLeave)
+      MENU[current].onLeave();
+    zone().rotateOff();
+
+    do
+      current = (current + 1) % N_MENU_ITEMS;
+    while (skipped(MENU[current]));
+
+    if (MENU[current].onEnter)
+      MENU[current].onEnter();
+    if (current == 0)
+      menuSwitchTimer = 0;
+  } else if (MENU[current].input) {
+    MENU[current].input(in);
+  } else if (MENU[current].get) {
+    handleValue(MENU[current], in);
+  }
+
+  if ((millis() - updateTimer) >= UPDATE_PERIOD) {
+    needUpdate = true;
+    updateTimer = millis();
+  }
+
+  if (!needUpdate)
+    return;
+
+  Frame frame;
+  draw(MENU[current], frame);
+  flush(frame);
+  needUpdate = false;
+}
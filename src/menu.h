@@ -0,0 +1,49 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <Arduino.h>
+#include <LiquidCrystal_I2C.h>
+
+#define LCD_COLS 16
+#define LCD_ROWS 2
+
+/*
+ * LCD menu driven by a table of MenuItem descriptors. A value item binds
+ * a setting through get/set with its limits, step and formatter; a view
+ * item draws (and optionally handles the buttons) itself. Every screen
+ * is drawn into a frame buffer and only the characters that differ from
+ * the display are sent over I2C.
+ */
+
+typedef char Frame[LCD_ROWS][LCD_COLS + 1];
+
+typedef struct {
+  bool menu, plus, minus;
+  bool plusHeld, minusHeld;
+  bool released;
+} MenuInput;
+
+typedef struct {
+  const char * label;
+
+  float (*get)();
+  void (*set)(float value);
+  float min, max, step;
+  void (*format)(char * buf, size_t size, float value);
+  bool (*editable)();
+
+  void (*onChange)();
+  void (*onEnter)();
+  void (*onLeave)();
+
+  void (*draw)(Frame frame);
+  void (*input)(const MenuInput & in);
+} MenuItem;
+
+extern int selectedZone;
+
+void menuBegin(LiquidCrystal_I2C * lcd);
+void menuInvalidate();
+void menuUpdate(const MenuInput & in);
+
+#endif
@@ -0,0 +1,237 @@
+#include "metrics.h"
+
+#include <math.h>
+
+#include "constants.h"
+#include "http.h"
+#include "memory.h"
+#include "relays.h"
+#include "safety.h"
+#include "reply.h"
+#include "supervisor.h"
+#include "zone.h"
+
+static void header(Print & out, const char * name, const char * type,
+                   const char * help)
+{
+  printFormat(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void zoneValue(Print & out, const char * name, int zone, double value) {
+  if (isnan(value))
+    printFormat(out, "%s{zone=\"%d\"} NaN\n", name, zone);
+  else
+    printFormat(out, "%s{zone=\"%d\"} %.3f\n", name, zone, value);
+}
+
+typedef struct {
+  const char * name;
+  const char * type;
+  const char * help;
+  double (*get)(Zone & zone);
+} ZoneMetric;
+
+static void zoneMetric(Print & out, const ZoneMetric & metric) {
+  header(out, metric.name, metric.type, metric.help);
+  for (int i = 0; i < N_ZONES; i++)
+    zoneValue(out, metric.name, i, metric.get(zones[i]));
+}
+
+static void relayOnMetrics(Print & out) {
+  RelayStats stats;
+
+  header(out, "incubator_relay_on", "gauge", "Relay is switched on.");
+  for (int i = 0; i < nRelays; i++) {
+    relaySnapshot(i, stats);
+    printFormat(out, "incubator_relay_on{zone=\"%d\",relay=\"%s\"} %d\n",
+      stats.zone, RELAY_NAMES[stats.kind], stats.on ? 1 : 0);
+  }
+}
+
+static void relayTransitionMetrics(Print & out) {
+  RelayStats stats;
+
+  header(out, "incubator_relay_transitions_total", "counter",
+    "Number of relay switchings.");
+  for (int i = 0; i < nRelays; i++) {
+    relaySnapshot(i, stats);
+    printFormat(out,
+      "incubator_relay_transitions_total{zone=\"%d\",relay=\"%s\"} %lu\n",
+      stats.zone, RELAY_NAMES[stats.kind], (unsigned long)stats.transitions);
+  }
+}
+
+static void relayTimeMetrics(Print & out) {
+  RelayStats stats;
+
+  header(out, "incubator_relay_on_seconds_total", "counter",
+    "Time the relay has been on.");
+  for (int i = 0; i < nRelays; i++) {
+    relaySnapshot(i, stats);
+    printFormat(out,
+      "incubator_relay_on_seconds_total{zone=\"%d\",relay=\"%s\"} %.3f\n",
+      stats.zone, RELAY_NAMES[stats.kind], stats.onTime / 1000.0);
+  }
+
+  header(out, "incubator_relay_last_change_seconds", "gauge",
+    "Uptime of the last relay switching.");
+  for (int i = 0; i < nRelays; i++) {
+    relaySnapshot(i, stats);
+    printFormat(out,
+      "incubator_relay_last_change_seconds{zone=\"%d\",relay=\"%s\"} %.3f\n",
+      stats.zone, RELAY_NAMES[stats.kind], stats.lastChange / 1000.0);
+  }
+}
+
+static void taskMetrics(Print & out) {
+  header(out, "incubator_task_last_seconds", "gauge",
+    "Duration of the last run of a loop task.");
+  for (int i = 0; i < N_TASKS; i++)
+    printFormat(out, "incubator_task_last_seconds{task=\"%s\"} %.6f\n",
+      TASK_NAMES[i], taskStats[i].lastUs / 1e6);
+
+  header(out, "incubator_task_max_seconds", "gauge",
+    "Longest run of a loop task.");
+  for (int i = 0; i < N_TASKS; i++)
+    printFormat(out, "incubator_task_max_seconds{task=\"%s\"} %.6f\n",
+      TASK_NAMES[i], taskStats[i].maxUs / 1e6);
+
+  header(out, "incubator_task_overruns_total", "counter",
+    "Runs of a loop task over its budget.");
+  for (int i = 0; i < N_TASKS; i++)
+    printFormat(out, "incubator_task_overruns_total{task=\"%s\"} %lu\n",
+      TASK_NAMES[i], (unsigned long)taskStats[i].overruns);
+}
+
+static const ZoneMetric ZONE_METRICS[] = {
+  {"incubator_temperature_celsius", "gauge",
+    "Fused chamber temperature.",
+    [](Zone & z) { return (double)z.currentTemperature; }},
+  {"incubator_temperature_sources", "gauge",
+    "Temperature probes used for the fused value.",
+    [](Zone & z) { return (double)z.thermoFusion.sources; }},
+  {"incubator_humidity_percent", "gauge",
+    "Chamber humidity.",
+    [](Zone & z) { return (double)z.currentHumidity; }},
+  {"incubator_needed_temperature_celsius", "gauge",
+    "Temperature setpoint.",
+    [](Zone & z) { return (double)z.config().neededTemperature; }},
+  {"incubator_needed_humidity_percent", "gauge",
+    "Humidity setpoint.",
+    [](Zone & z) { return (double)z.config().neededHumidity; }},
+  {"incubator_alarm", "gauge",
+    "Overheat alarm is active.",
+    [](Zone & z) { return z.alarm ? 1.0 : 0.0; }},
+  {"incubator_wetter_duty", "gauge",
+    "Wetter duty cycle over the last window.",
+    [](Zone & z) { return (double)z.climate.humidifier.duty; }},
+  {"incubator_wetter_gain", "gauge",
+    "Learned humidity rise per second of wetting.",
+    [](Zone & z) { return (double)z.climate.humidifier.gain; }},
+  {"incubator_heater_duty", "gauge",
+    "Heater duty of the current window under model control.",
+    [](Zone & z) { return (double)z.climate.heating.duty; }},
+  {"incubator_heater_model_gain", "gauge",
+    "Identified heater gain, degrees above ambient at full duty.",
+    [](Zone & z) { return (double)z.climate.heating.model.gain; }},
+  {"incubator_heater_model_tau_seconds", "gauge",
+    "Identified chamber time constant.",
+    [](Zone & z) { return (double)z.climate.heating.model.tau; }},
+  {"incubator_fusion_max_seconds", "gauge",
+    "Longest sensor fusion update.",
+    [](Zone & z) { return z.fusionMaxUs / 1e6; }}
+};
+
+#define N_ZONE_METRICS ((int)(sizeof(ZONE_METRICS) / sizeof(ZONE_METRICS[0])))
+
+static void safetyMetrics(Print & out) {
+  header(out, "incubator_safety_runs_total", "counter",
+    "Runs of the safety timer.");
+  printFormat(out, "incubator_safety_runs_total %lu\n",
+    (unsigned long)safetyStats.runs);
+
+  header(out, "incubator_safety_max_seconds", "gauge",
+    "Longest run of the safety timer.");
+  printFormat(out, "incubator_safety_max_seconds %.6f\n",
+    safetyStats.maxUs / 1e6);
+
+  header(out, "incubator_safety_stale_total", "counter",
+    "Safety checks on a temperature that was not republished in time.");
+  printFormat(out, "incubator_safety_stale_total %lu\n",
+    (unsigned long)safetyStats.stale);
+
+  header(out, "incubator_safety_torn_total", "counter",
+    "Safety checks that caught a snapshot write and used the previous one.");
+  printFormat(out, "incubator_safety_torn_total %lu\n",
+    (unsigned long)safetyStats.torn);
+}
+
+static void httpMetrics(Print & out) {
+  header(out, "incubator_http_requests_total", "counter",
+    "HTTP connections by outcome.");
+  printFormat(out,
+    "incubator_http_requests_total{outcome=\"served\"} %lu\n"
+    "incubator_http_requests_total{outcome=\"rate_limited\"} %lu\n"
+    "incubator_http_requests_total{outcome=\"shed\"} %lu\n"
+    "incubator_http_requests_total{outcome=\"timeout\"} %lu\n",
+    (unsigned long)netStats.served,
+    (unsigned long)netStats.rateLimited,
+    (unsigned long)netStats.shed,
+    (unsigned long)netStats.timeouts);
+
+  header(out, "incubator_http_accepted_total", "counter",
+    "HTTP connections taken for serving.");
+  printFormat(out, "incubator_http_accepted_total %lu\n",
+    (unsigned long)netStats.accepted);
+
+  header(out, "incubator_http_received_bytes_total", "counter",
+    "Bytes read from HTTP clients.");
+  printFormat(out, "incubator_http_received_bytes_total %lu\n",
+    (unsigned long)netStats.bytesIn);
+
+  header(out, "incubator_http_slices_exhausted_total", "counter",
+    "loop() passes that used the whole network slice.");
+  printFormat(out, "incubator_http_slices_exhausted_total %lu\n",
+    (unsigned long)netStats.slicesExhausted);
+
+  header(out, "incubator_http_max_slice_seconds", "gauge",
+    "Longest network slice.");
+  printFormat(out, "incubator_http_max_slice_seconds %.6f\n",
+    netStats.maxSliceUs / 1e6);
+
+  header(out, "incubator_http_load", "gauge",
+    "Share of the loop time spent on the network.");
+  printFormat(out, "incubator_http_load %.4f\n", (double)netStats.load);
+}
+
+static void systemMetrics(Print & out) {
+  header(out, "incubator_heap_violations_total", "counter",
+    "Heap allocations after setup.");
+  printFormat(out, "incubator_heap_violations_total %lu\n",
+    (unsigned long)heapStats.violations);
+
+  header(out, "incubator_uptime_seconds", "counter", "Time since boot.");
+  printFormat(out, "incubator_uptime_seconds %.3f\n", millis() / 1000.0);
+}
+
+/* the parts after the zone metrics; each fits the ANSWER_SIZE buffer
+   it is sent from */
+static void (* const PARTS[])(Print & out) = {
+  relayOnMetrics, relayTransitionMetrics, relayTimeMetrics,
+  taskMetrics, safetyMetrics, httpMetrics, systemMetrics
+};
+
+#define N_PARTS ((int)(sizeof(PARTS) / sizeof(PARTS[0])))
+
+bool writeMetrics(Print & out, int part) {
+  if (part < N_ZONE_METRICS) {
+    zoneMetric(out, ZONE_METRICS[part]);
+    return true;
+  }
+  part -= N_ZONE_METRICS;
+  if (part < N_PARTS) {
+    PARTS[part](out);
+    return true;
+  }
+  return false;
+}
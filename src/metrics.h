@@ -0,0 +1,15 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+/*
+ * /metrics in the Prometheus text format: relay accounting, sensor
+ * values and loop statistics. The output comes in parts numbered from
+ * 0, each at most ANSWER_SIZE long, so that it can be printed into a
+ * buffer and sent over several loop() passes; false when part is past
+ * the last one.
+ */
+bool writeMetrics(Print & out, int part);
+
+#endif
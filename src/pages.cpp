@@ -2,31 +2,95 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "assets_data.h"
+#include "constants.h"
+
 const char * HTTP_CODES[] = {
   "HTTP/1.1 200 OK",
-  "HTTP/1.1 404 Not Found"
+  "HTTP/1.1 404 Not Found",
+  "HTTP/1.1 429 Too Many Requests",
+  "HTTP/1.1 503 Service Unavailable"
+};
+
+/* replies to requests turned away early, sent like an asset */
+#define BUSY_REPLY(status) \
+  "HTTP/1.1 " status "\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 6\r\n" \
+  "Connection: close\r\n" \
+  "\r\n" \
+  "busy\r\n"
+
+static const char BUSY_429[] = BUSY_REPLY("429 Too Many Requests");
+static const char BUSY_503[] = BUSY_REPLY("503 Service Unavailable");
+
+static const Response busy429 = {
+  (const uint8_t *)BUSY_429, sizeof(BUSY_429) - 1
+};
+static const Response busy503 = {
+  (const uint8_t *)BUSY_503, sizeof(BUSY_503) - 1
 };
 
-const char msg404[] =
-  DOCTYPE_HTML4 "\r\n"
-  "<html>\r\n"
-  "<head><title>Error</title></head>\r\n"
-  "<body>\r\n"
-  "<h1 align=\"center\">Error 404: page not found</h1>\r\n"
-  "<hr>\r\n" FOOTER "\r\n"
-  "</body>\r\n"
-  "</html>\r\n";
-
-const char msgWelcome[] = 
-  DOCTYPE_HTML4 "\r\n"
-  "<html>\r\n"
-  "<head><title>Incubator</title></head>\r\n"
-  "<body>\r\n"
-  "<h1 align=\"center\">The IoT-incubator</h1>\r\n"
-  "<p align=\"center\">Created by Kondratenko Daniel in 2021</p>\r\n"
-  "<hr>\r\n" FOOTER "\r\n"
-  "</body>\r\n"
-  "</html>\r\n";
+const Asset * findAsset(const char * path) {
+  const Asset * notFound = NULL;
+
+  for (size_t i = 0; i < N_ASSETS; i++) {
+    if (assets[i].path == NULL)
+      notFound = &assets[i];
+    else if (strcmp(assets[i].path, path) == 0)
+      return &assets[i];
+  }
+
+  return notFound;
+}
+
+/* the tags keep their quotes, so "x" is not found in "x-gz" */
+uint8_t etagMatches(const Asset * asset, const char * ifNoneMatch) {
+  uint8_t matched = 0;
+
+  if (asset->etag == NULL)
+    return 0;
+  if (strcmp(ifNoneMatch, "*") == 0)
+    return ETAG_FULL | ETAG_GZIP;
+  if (strstr(ifNoneMatch, asset->etag) != NULL)
+    matched |= ETAG_FULL;
+  if (asset->gzipEtag && strstr(ifNoneMatch, asset->gzipEtag) != NULL)
+    matched |= ETAG_GZIP;
+  return matched;
+}
+
+const Response * assetResponse(
+  const Asset * asset,
+  uint8_t etagMatched,
+  bool acceptGzip
+)
+{
+  if (acceptGzip && asset->gzip.data) {
+    if ((etagMatched & ETAG_GZIP) && asset->gzipNotModified.data)
+      return &asset->gzipNotModified;
+    return &asset->gzip;
+  }
+  if ((etagMatched & ETAG_FULL) && asset->notModified.data)
+    return &asset->notModified;
+  return &asset->full;
+}
+
+const Response * busyResponse(int code) {
+  return code == HTTP_429_TOO_MANY_REQUESTS ? &busy429 : &busy503;
+}
+
+void sendStreamHeader(Print & out, int code, const char * type) {
+  static char header[HEADER_BUFFER_SIZE];
+
+  int n = snprintf(header, sizeof(header),
+    "%s\r\n"
+    "Content-Type: %s\r\n"
+    "Connection: close\r\n"
+    "\r\n",
+    HTTP_CODES[code], type);
+
+  out.write((const uint8_t *)header, n);
+}
 
 void sendPage(
   WiFiClient & client,
@@ -35,17 +99,19 @@ void sendPage(
   const char * message
 )
 {
-  char content_type_buf[256];
-  char content_length_buf[256];
+  static char header[HEADER_BUFFER_SIZE];
 
   size_t content_len = strlen(message);
 
-  sprintf(content_type_buf, "Content-Type: %s", type);
-  sprintf(content_length_buf, "Content-Length: %ld", content_len + 2);
+  /* the body is followed by CRLF, as println() used to do */
+  int n = snprintf(header, sizeof(header),
+    "%s\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Length: %u\r\n"
+    "\r\n",
+    HTTP_CODES[code], type, (unsigned)(content_len + 2));
 
-  client.println(HTTP_CODES[code]);
-  client.println(content_type_buf);
-  client.println(content_length_buf);
-  client.println();
-  client.println(message);
+  client.write((const uint8_t *)header, n);
+  client.write((const uint8_t *)message, content_len);
+  client.write((const uint8_t *)"\r\n", 2);
 }
@@ -4,22 +4,54 @@
 #include <Arduino.h>
 #include <WiFiNINA.h>
 
-#define DOCTYPE_HTML4 \
-  "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\" " \
-  "\"http://www.w3.org/TR/html4/strict.dtd\">"
-
-#define FOOTER  "<p><i>IncubatorServer " __DATE__ " " __TIME__ "</i></p>"
-
-extern const char msg404[];
-extern const char msgWelcome[];
-
 enum HttpCodes {
   HTTP_200_OK,
-  HTTP_404_NOT_FOUND
+  HTTP_404_NOT_FOUND,
+  HTTP_429_TOO_MANY_REQUESTS,
+  HTTP_503_SERVICE_UNAVAILABLE
 };
 
 extern const char * HTTP_CODES[];
 
+typedef struct {
+  const uint8_t * data;
+  size_t len;
+} Response;
+
+/*
+ * Static page with its complete responses precomputed at build time
+ * by scripts/gen_assets.py. The entry with a NULL path is the 404 page.
+ */
+typedef struct {
+  const char * path;
+  const char * etag;
+  const char * gzipEtag;
+  Response full;
+  Response gzip;
+  Response notModified;
+  Response gzipNotModified;
+} Asset;
+
+/* representations named by an If-None-Match header */
+#define ETAG_FULL 0x01
+#define ETAG_GZIP 0x02
+
+const Asset * findAsset(const char * path);
+uint8_t etagMatches(const Asset * asset, const char * ifNoneMatch);
+
+/* the precomputed response to send for a request of the asset */
+const Response * assetResponse(
+  const Asset * asset,
+  uint8_t etagMatched,
+  bool acceptGzip
+);
+
+/* the whole reply that turns a request away, HTTP_429 or HTTP_503 */
+const Response * busyResponse(int code);
+
+/* headers of a reply without Content-Length, closed after the body */
+void sendStreamHeader(Print & out, int code, const char * type);
+
 void sendPage(
   WiFiClient & client, 
   int code, 
@@ -29,4 +61,3 @@ void sendPage(
 
 #endif
 
-
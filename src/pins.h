@@ -28,4 +28,31 @@ const int PositionM45   = A1;
 const int PositionN00   = A2;
 const int PositionP45   = A3;
 
+/* Zones */
+
+#define NO_PIN -1
+
+typedef struct {
+  int dht, ds;
+  int motorP, motorM;
+  int wetter, cooler, heater, ring, ventil;
+  int posM45, posN00, posP45;
+} ZonePins;
+
+/*
+ * One entry per incubator zone driven by this board. A zone without
+ * a turner (e.g. a hatcher) has NO_PIN for its motor relays and reed
+ * switches.
+ */
+const ZonePins zonePins[] = {
+  {
+    DHTPin, DSPin,
+    RelayMotorP, RelayMotorM,
+    RelayWetter, RelayCooler, RelayHeater, RelayRing, RelayVentil,
+    PositionM45, PositionN00, PositionP45
+  }
+};
+
+#define N_ZONES ((int)(sizeof(zonePins) / sizeof(zonePins[0])))
+
 #endif
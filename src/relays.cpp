@@ -0,0 +1,92 @@
+#include "relays.h"
+
+#include <mbed.h>
+
+#include "constants.h"
+#include "trace.h"
+
+const char * RELAY_NAMES[N_RELAY_KINDS] = {
+  "motor_p",
+  "motor_m",
+  "wetter",
+  "cooler",
+  "heater",
+  "ring",
+  "ventil"
+};
+
+static RelayStats relays[MAX_RELAYS];
+int nRelays = 0;
+
+/* pin -> index in relays[], -1 for pins that are not relays */
+static int8_t relayOfPin[RELAY_MAX_PIN];
+
+static int findRelay(int pin) {
+  if (pin < 0 || pin >= RELAY_MAX_PIN)
+    return -1;
+  return relayOfPin[pin] - 1;
+}
+
+void relayAttach(int pin, int zone, RelayKind kind) {
+  if (pin == NO_PIN)
+    return;
+
+  pinMode(pin, OUTPUT);
+  if (pin >= RELAY_MAX_PIN || nRelays >= MAX_RELAYS || findRelay(pin) >= 0)
+    return;
+
+  RelayStats & relay = relays[nRelays];
+  relay = RelayStats();
+  relay.pin = pin;
+  relay.zone = zone;
+  relay.kind = kind;
+  relayOfPin[pin] = ++nRelays;
+}
+
+void relayWrite(int pin, int state) {
+  if (pin == NO_PIN)
+    return;
+
+  digitalWrite(pin, state);
+
+  int i = findRelay(pin);
+  if (i < 0)
+    return;
+
+  bool on = (state == ON);
+  uint32_t now = millis();
+
+  bool changed = true;
+
+  core_util_critical_section_enter();
+  RelayStats & relay = relays[i];
+  if (!relay.known) {
+    /* the first write only sets the initial state */
+    relay.known = true;
+    relay.on = on;
+    relay.lastChange = now;
+  } else if (relay.on != on) {
+    if (relay.on)
+      relay.onTime += now - relay.lastChange;
+    relay.on = on;
+    relay.transitions++;
+    relay.lastChange = now;
+  } else {
+    changed = false;
+  }
+  core_util_critical_section_exit();
+
+  if (changed)
+    traceRelay(relays[i].zone, relays[i].kind, on);
+}
+
+void relaySnapshot(int i, RelayStats & stats) {
+  uint32_t now = millis();
+
+  core_util_critical_section_enter();
+  stats = relays[i];
+  core_util_critical_section_exit();
+
+  if (stats.on)
+    stats.onTime += now - stats.lastChange;
+}
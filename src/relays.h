@@ -0,0 +1,37 @@
+#ifndef RELAYS_H
+#define RELAYS_H
+
+#include <Arduino.h>
+
+#include "pins.h"
+#include "tracefmt.h"
+
+/*
+ * Every relay write goes through relayWrite(), which counts the
+ * switchings of the relay and how long it has been on. Safe to call
+ * from interrupt context (the supervisor's forceSafe()).
+ */
+
+#define MAX_RELAYS (N_ZONES * N_RELAY_KINDS)
+
+typedef struct {
+  int pin;
+  uint8_t zone;
+  uint8_t kind;
+  bool known;
+  bool on;
+  uint32_t transitions;
+  uint64_t onTime;
+  uint32_t lastChange;
+} RelayStats;
+
+extern const char * RELAY_NAMES[N_RELAY_KINDS];
+extern int nRelays;
+
+void relayAttach(int pin, int zone, RelayKind kind);
+void relayWrite(int pin, int state);
+
+/* consistent copy of relay i, with the current on-stretch included */
+void relaySnapshot(int i, RelayStats & stats);
+
+#endif
@@ -0,0 +1,61 @@
+#include "reply.h"
+
+#include <stdarg.h>
+
+#include "constants.h"
+
+static char formatBuf[FORMAT_BUFFER_SIZE];
+
+ReplyBuffer::ReplyBuffer(char * buf, size_t size)
+  : buf(buf), size(size)
+{
+  clear();
+}
+
+void ReplyBuffer::clear() {
+  len = 0;
+  buf[0] = '\0';
+  overflow = false;
+}
+
+size_t ReplyBuffer::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t ReplyBuffer::write(const uint8_t * data, size_t n) {
+  if (len + n >= size) {
+    overflow = true;
+    n = size - 1 - len;
+  }
+
+  memcpy(buf + len, data, n);
+  len += n;
+  buf[len] = '\0';
+  return n;
+}
+
+/* a truncated reply ends with "error overflow" instead of a cut line */
+void ReplyBuffer::endReply() {
+  static const char marker[] = "\r\nerror overflow\r\n";
+
+  if (!overflow)
+    return;
+  if (len + sizeof(marker) > size)
+    len = size - sizeof(marker);
+  memcpy(buf + len, marker, sizeof(marker));
+  len += sizeof(marker) - 1;
+}
+
+size_t printFormat(Print & out, const char * format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  int n = vsnprintf(formatBuf, sizeof(formatBuf), format, args);
+  va_end(args);
+
+  if (n < 0)
+    return 0;
+  if ((size_t)n >= sizeof(formatBuf))
+    n = sizeof(formatBuf) - 1;
+  return out.write((const uint8_t *)formatBuf, n);
+}
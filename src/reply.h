@@ -0,0 +1,35 @@
+#ifndef REPLY_H
+#define REPLY_H
+
+#include <Arduino.h>
+
+/*
+ * Print into a fixed buffer. Output that does not fit is dropped and
+ * flagged, so replies never need the heap; endReply() then replaces
+ * the end of the reply with a line saying so.
+ */
+class ReplyBuffer : public Print {
+  public:
+    ReplyBuffer(char * buf, size_t size);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t * data, size_t n) override;
+
+    void clear();
+    void endReply();
+    const char * c_str() { return buf; }
+    size_t length() { return len; }
+
+    bool overflow;
+
+  private:
+    char * buf;
+    size_t size;
+    size_t len;
+};
+
+/* printf() to any Print through one static formatting buffer */
+size_t printFormat(Print & out, const char * format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+#endif
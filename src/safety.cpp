@@ -0,0 +1,53 @@
+#include "safety.h"
+
+#include <atomic>
+#include <mbed.h>
+
+#include "constants.h"
+#include "zone.h"
+
+SafetyStats safetyStats;
+
+static mbed::Ticker safetyTicker;
+
+/* writer side, loop() only */
+void thermalPublish(ThermalSnapshot & snapshot, const ThermalSample & sample) {
+  snapshot.seq = snapshot.seq + 1;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  snapshot.sample = sample;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  snapshot.seq = snapshot.seq + 1;
+}
+
+/* false if a write was in progress; never waits */
+bool thermalRead(const ThermalSnapshot & snapshot, ThermalSample & sample) {
+  uint32_t seq = snapshot.seq;
+  if (seq & 1)
+    return false;
+
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  ThermalSample copy = snapshot.sample;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+
+  if (snapshot.seq != seq)
+    return false;
+  sample = copy;
+  return true;
+}
+
+static void safetyTick() {
+  uint32_t start = micros();
+  uint32_t now = millis();
+
+  for (int i = 0; i < N_ZONES; i++)
+    zones[i].safetyUpdate(now);
+
+  safetyStats.runs++;
+  safetyStats.lastUs = micros() - start;
+  if (safetyStats.lastUs > safetyStats.maxUs)
+    safetyStats.maxUs = safetyStats.lastUs;
+}
+
+void safetyBegin() {
+  safetyTicker.attach(&safetyTick, std::chrono::milliseconds(SAFETY_PERIOD));
+}
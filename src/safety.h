@@ -0,0 +1,44 @@
+#ifndef SAFETY_H
+#define SAFETY_H
+
+#include <Arduino.h>
+
+/*
+ * Heater, alarm and vent run from a fixed-rate timer interrupt instead
+ * of loop(), so their response time does not depend on how long the
+ * sensors, the display or the network take. loop() publishes the fused
+ * temperature of every zone through a seqlock; the interrupt never
+ * waits on it and keeps its last good copy if it catches a write in
+ * progress. Flash erases in loop() mask the timer for up to 400 ms,
+ * at most one per loop pass (see flashring.h), so the heater reacts
+ * within SAFETY_PERIOD plus that.
+ */
+
+typedef struct {
+  float temperature;
+  float neededTemperature;
+  float previewTemperature;
+  uint32_t time;
+} ThermalSample;
+
+typedef struct {
+  volatile uint32_t seq;
+  ThermalSample sample;
+} ThermalSnapshot;
+
+typedef struct {
+  uint32_t runs;
+  uint32_t lastUs;
+  uint32_t maxUs;
+  uint32_t torn;
+  uint32_t stale;
+} SafetyStats;
+
+extern SafetyStats safetyStats;
+
+void thermalPublish(ThermalSnapshot & snapshot, const ThermalSample & sample);
+bool thermalRead(const ThermalSnapshot & snapshot, ThermalSample & sample);
+
+void safetyBegin();
+
+#endif
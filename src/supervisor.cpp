@@ -0,0 +1,125 @@
+#include "supervisor.h"
+
+#include <mbed.h>
+#include <hardware/watchdog.h>
+
+#include "constants.h"
+#include "zone.h"
+
+#define CRASH_MAGIC 0xC0DE0000UL
+
+const char * TASK_NAMES[N_TASKS] = {
+  "inputs",
+  "zones",
+  "display",
+  "network",
+  "storage"
+};
+
+const uint32_t TASK_BUDGETS[N_TASKS] = {
+  BUDGET_INPUTS,
+  BUDGET_ZONES,
+  BUDGET_DISPLAY,
+  BUDGET_NETWORK,
+  BUDGET_STORAGE
+};
+
+TaskStats taskStats[N_TASKS];
+CrashRecord lastCrash;
+bool resetByWatchdog = false;
+
+static mbed::Ticker stallTicker;
+
+static volatile uint8_t currentTask = TASK_NONE;
+static volatile uint32_t taskStartUs = 0;
+static volatile uint32_t taskStartMs = 0;
+static volatile uint32_t lastFeed = 0;
+static volatile bool stalled = false;
+
+static void readCrashRecord() {
+  uint32_t head = watchdog_hw->scratch[0];
+
+  if ((head & 0xFFFF0000UL) != CRASH_MAGIC) {
+    lastCrash = CrashRecord();
+    return;
+  }
+
+  lastCrash.count = head & 0xFFFF;
+  lastCrash.task = watchdog_hw->scratch[1] & 0xFF;
+  lastCrash.reason = (watchdog_hw->scratch[1] >> 8) & 0xFF;
+  lastCrash.duration = watchdog_hw->scratch[2];
+  lastCrash.uptime = watchdog_hw->scratch[3];
+}
+
+static void writeCrashRecord(uint8_t task, uint8_t reason, uint32_t duration) {
+  lastCrash.count++;
+  lastCrash.task = task;
+  lastCrash.reason = reason;
+  lastCrash.duration = duration;
+  lastCrash.uptime = millis() / 1000;
+
+  watchdog_hw->scratch[1] = task | ((uint32_t)reason << 8);
+  watchdog_hw->scratch[2] = duration;
+  watchdog_hw->scratch[3] = lastCrash.uptime;
+  watchdog_hw->scratch[0] = CRASH_MAGIC | (lastCrash.count & 0xFFFF);
+}
+
+/*
+ * Runs from the ticker interrupt, so it still works while loop() is
+ * stuck in a task. Puts every zone into a safe state before the reset.
+ */
+static void checkStall() {
+  if (stalled || (millis() - lastFeed) < WATCHDOG_STALL_TIME)
+    return;
+
+  stalled = true;
+  for (int i = 0; i < N_ZONES; i++)
+    zones[i].forceSafe();
+
+  writeCrashRecord(currentTask, CRASH_STALL, millis() - taskStartMs);
+  watchdog_reboot(0, 0, 0);
+}
+
+void supervisorBegin() {
+  resetByWatchdog = watchdog_caused_reboot();
+  readCrashRecord();
+
+  lastFeed = millis();
+  watchdog_enable(WATCHDOG_TIMEOUT, true);
+  stallTicker.attach(&checkStall,
+    std::chrono::milliseconds(WATCHDOG_CHECK_PERIOD));
+}
+
+void taskBegin(Task task) {
+  taskStartMs = millis();
+  taskStartUs = micros();
+  currentTask = task;
+}
+
+void taskEnd() {
+  uint32_t elapsed = micros() - taskStartUs;
+  uint8_t task = currentTask;
+
+  currentTask = TASK_NONE;
+  if (task >= N_TASKS)
+    return;
+
+  TaskStats & stats = taskStats[task];
+  stats.lastUs = elapsed;
+  if (elapsed > stats.maxUs)
+    stats.maxUs = elapsed;
+
+  /* counted only: the scratch record is kept for the last stall */
+  if (elapsed > TASK_BUDGETS[task] * 1000UL)
+    stats.overruns++;
+}
+
+void supervisorFeed() {
+  lastFeed = millis();
+  watchdog_update();
+}
+
+void clearCrashRecord() {
+  watchdog_hw->scratch[0] = 0;
+  lastCrash = CrashRecord();
+}
@@ -0,0 +1,54 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <Arduino.h>
+
+/*
+ * Hardware watchdog with a deadline budget for every subsystem served
+ * by loop(). Overruns are counted in taskStats; a stall is kept in
+ * the watchdog scratch registers, which survive the reset it causes.
+ */
+
+enum Task {
+  TASK_INPUTS = 0,
+  TASK_ZONES,
+  TASK_DISPLAY,
+  TASK_NETWORK,
+  TASK_STORAGE,
+  N_TASKS,
+  TASK_NONE = 0xFF
+};
+
+enum CrashReason {
+  CRASH_NONE = 0,
+  CRASH_STALL = 2
+};
+
+typedef struct {
+  uint32_t count;
+  uint8_t task;
+  uint8_t reason;
+  uint32_t duration;
+  uint32_t uptime;
+} CrashRecord;
+
+typedef struct {
+  uint32_t lastUs;
+  uint32_t maxUs;
+  uint32_t overruns;
+} TaskStats;
+
+extern const char * TASK_NAMES[N_TASKS];
+extern const uint32_t TASK_BUDGETS[N_TASKS];
+
+extern TaskStats taskStats[N_TASKS];
+extern CrashRecord lastCrash;
+extern bool resetByWatchdog;
+
+void supervisorBegin();
+void taskBegin(Task task);
+void taskEnd();
+void supervisorFeed();
+void clearCrashRecord();
+
+#endif
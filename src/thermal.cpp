@@ -0,0 +1,359 @@
+#include "thermal.h"
+
+#include <math.h>
+#include <string.h>
+
+static float clampf(float value, float low, float high) {
+  return (value < low) ? low : ((value > high) ? high : value);
+}
+
+/* moves one value between an object and its saved state */
+static void transfer(uint32_t * words, size_t & n, void * value, bool restore) {
+  if (restore)
+    memcpy(value, &words[n], sizeof(uint32_t));
+  else
+    memcpy(&words[n], value, sizeof(uint32_t));
+  n++;
+}
+
+void ThermalModel::begin() {
+  for (int d = 0; d < THERMAL_DELAYS; d++) {
+    theta[d][0] = THERMAL_INITIAL_POLE;
+    theta[d][1] = 0;
+    theta[d][2] = 0;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        cov[d][i][j] = (i == j) ? THERMAL_RLS_INIT : 0;
+    error[d] = 0;
+    duties[d] = 0;
+  }
+
+  last = NAN;
+  samples = 0;
+  gain = 0;
+  tau = 0;
+  deadTime = 0;
+  ambient = 0;
+}
+
+/* one recursive least squares step of the estimator for dead time d */
+void ThermalModel::fit(int d, float x0, float y) {
+  float x[3] = {x0, duties[d], 1};
+  float px[3];
+  float trace = 0;
+  float denom;
+
+  for (int i = 0; i < 3; i++) {
+    px[i] = cov[d][i][0] * x[0] + cov[d][i][1] * x[1] + cov[d][i][2] * x[2];
+    trace += cov[d][i][i];
+  }
+
+  /* no forgetting while the input does not excite the model */
+  float lambda = (trace > THERMAL_RLS_MAX_TRACE) ? 1.0F : THERMAL_FORGET;
+  denom = lambda + x[0] * px[0] + x[1] * px[1] + x[2] * px[2];
+
+  float e = y - (theta[d][0] * x[0] + theta[d][1] * x[1] + theta[d][2] * x[2]);
+  error[d] += THERMAL_ERROR_ALPHA * (e * e - error[d]);
+
+  for (int i = 0; i < 3; i++)
+    theta[d][i] += px[i] * e / denom;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      cov[d][i][j] = (cov[d][i][j] - px[i] * px[j] / denom) / lambda;
+}
+
+/* once per window, with the heater duty of the window that ended */
+void ThermalModel::update(float temperature, float duty) {
+  for (int d = THERMAL_DELAYS - 1; d > 0; d--)
+    duties[d] = duties[d - 1];
+  duties[0] = duty;
+
+  if (isnan(temperature) || isnan(last)) {
+    last = temperature;
+    return;
+  }
+
+  for (int d = 0; d < THERMAL_DELAYS; d++)
+    fit(d, last - THERMAL_OFFSET, temperature - THERMAL_OFFSET);
+  last = temperature;
+  samples++;
+
+  int best = 0;
+  for (int d = 1; d < THERMAL_DELAYS; d++)
+    if (error[d] < error[best])
+      best = d;
+
+  float a = theta[best][0];
+  float b = theta[best][1];
+  float c = theta[best][2];
+  if (a <= 0 || a >= 1 || b <= 0) {
+    gain = 0;
+    return;
+  }
+
+  gain = b / (1 - a);
+  tau = -(THERMAL_WINDOW / 1000.0F) / logf(a);
+  deadTime = best * (THERMAL_WINDOW / 1000.0F);
+  ambient = THERMAL_OFFSET + c / (1 - a);
+}
+
+bool ThermalModel::valid() const {
+  return samples >= THERMAL_MIN_SAMPLES
+    && gain >= THERMAL_MIN_GAIN && gain <= THERMAL_MAX_GAIN
+    && tau >= THERMAL_WINDOW / 1000.0F && tau <= THERMAL_MAX_TAU;
+}
+
+/* cov stays symmetric, so its upper half is the whole of it */
+void ThermalModel::state(uint32_t * words, bool restore) {
+  size_t n = 0;
+
+  for (int d = 0; d < THERMAL_DELAYS; d++) {
+    for (int i = 0; i < 3; i++)
+      transfer(words, n, &theta[d][i], restore);
+    for (int i = 0; i < 3; i++)
+      for (int j = i; j < 3; j++) {
+        transfer(words, n, &cov[d][i][j], restore);
+        cov[d][j][i] = cov[d][i][j];
+      }
+    transfer(words, n, &error[d], restore);
+    transfer(words, n, &duties[d], restore);
+  }
+  transfer(words, n, &last, restore);
+  transfer(words, n, &samples, restore);
+  transfer(words, n, &gain, restore);
+  transfer(words, n, &tau, restore);
+  transfer(words, n, &deadTime, restore);
+  transfer(words, n, &ambient, restore);
+}
+
+void HeaterController::state(uint32_t * words, bool restore) {
+  size_t n = THERMAL_MODEL_WORDS;
+  uint32_t flags = mode | (on << 8) | (mirrored << 9) | ((uint8_t)tuneResult << 16);
+
+  model.state(words, restore);
+  transfer(words, n, &flags, restore);
+  transfer(words, n, &duty, restore);
+  transfer(words, n, &kc, restore);
+  transfer(words, n, &ti, restore);
+  transfer(words, n, &ku, restore);
+  transfer(words, n, &pu, restore);
+  transfer(words, n, &tick, restore);
+  transfer(words, n, &onTicks, restore);
+  transfer(words, n, &integral, restore);
+  transfer(words, n, &reference, restore);
+  transfer(words, n, &previewReference, restore);
+  transfer(words, n, &tuneTicks, restore);
+  transfer(words, n, &tuneRise, restore);
+  transfer(words, n, &tuneCycles, restore);
+  transfer(words, n, &tuneMax, restore);
+  transfer(words, n, &tuneMin, restore);
+  transfer(words, n, &tunePeriods, restore);
+  transfer(words, n, &tuneAmplitudes, restore);
+
+  if (restore) {
+    mode = (HeaterMode)(flags & 0xFF);
+    on = (flags >> 8) & 1;
+    mirrored = (flags >> 9) & 1;
+    tuneResult = (int8_t)(flags >> 16);
+  }
+}
+
+void HeaterController::begin() {
+  mode = HEATER_HYSTERESIS;
+  model.begin();
+  on = false;
+
+  duty = 0;
+  kc = 0;
+  ti = 0;
+  ku = 0;
+  pu = 0;
+  tuneResult = 0;
+  tuneRequest = 0;
+  tuneRequests = 0;
+  tuneHandled = 0;
+
+  tick = 0;
+  onTicks = 0;
+  mirrored = false;
+  integral = 0;
+  reference = NAN;
+  previewReference = NAN;
+}
+
+bool HeaterController::hysteresis(float temperature, float needed) {
+  if (temperature < needed - TEMPERATURE_HYSTERESIS) {
+    on = true;
+  } else if (temperature >= needed) {
+    on = false;
+  }
+  return on;
+}
+
+/* duty of the next window: feed-forward from the model plus PI */
+void HeaterController::startWindow(float temperature, float needed, float preview) {
+  float window = THERMAL_WINDOW / 1000.0F;
+  bool modelValid = model.valid();
+  float tc = THERMAL_MIN_TC;
+
+  if (mode == HEATER_AUTOTUNE)
+    return;
+
+  if (modelValid && model.deadTime > tc)
+    tc = model.deadTime;
+
+  if (ku > 0) {
+    /* Tyreus-Luyben from the relay-feedback test */
+    kc = ku / 3.2F;
+    ti = 2.2F * pu;
+  } else if (modelValid) {
+    /* SIMC rules for a first order plus dead time plant */
+    kc = model.tau / (model.gain * (tc + model.deadTime));
+    ti = fminf(model.tau, 4 * (tc + model.deadTime));
+  } else {
+    mode = HEATER_HYSTERESIS;
+    return;
+  }
+
+  if (mode != HEATER_PI) {
+    mode = HEATER_PI;
+    integral = 0;
+    reference = needed;
+    previewReference = preview;
+  }
+
+  /* setpoint steps are followed along a first order trajectory */
+  float alpha = window / (tc + window);
+  float lastPreview = previewReference;
+  reference += alpha * (needed - reference);
+  previewReference += alpha * (preview - previewReference);
+
+  float ff = 0;
+  if (modelValid)
+    ff = (previewReference - model.ambient) / model.gain
+       + model.tau * (previewReference - lastPreview) / (model.gain * window);
+
+  float e = reference - temperature;
+  float u = ff + kc * (e + integral / ti);
+
+  /* integrate only while that does not push further into saturation */
+  float next = integral + e * window;
+  float unext = ff + kc * (e + next / ti);
+  if ((unext > 0 && unext < 1) || (unext >= 1 && e < 0) || (unext <= 0 && e > 0)) {
+    integral = next;
+    u = unext;
+  }
+
+  duty = clampf(u, 0, 1);
+  if (duty * THERMAL_WINDOW < THERMAL_MIN_PULSE)
+    duty = 0;
+  else if ((1 - duty) * THERMAL_WINDOW < THERMAL_MIN_PULSE)
+    duty = 1;
+}
+
+void HeaterController::endAutotune(bool done) {
+  tuneResult = done ? 1 : -1;
+  mode = HEATER_HYSTERESIS;
+}
+
+/*
+ * Relay feedback: heat below needed - THERMAL_TUNE_HYSTERESIS, stop
+ * above needed + THERMAL_TUNE_HYSTERESIS, and measure the period and
+ * amplitude of the oscillation after the first cycle.
+ */
+bool HeaterController::autotune(float temperature, float needed) {
+  tuneTicks++;
+  if (tuneTicks * SAFETY_PERIOD >= THERMAL_TUNE_TIMEOUT) {
+    endAutotune(false);
+    return hysteresis(temperature, needed);
+  }
+
+  if (temperature > tuneMax)
+    tuneMax = temperature;
+  if (temperature < tuneMin)
+    tuneMin = temperature;
+
+  if (!on && temperature < needed - THERMAL_TUNE_HYSTERESIS) {
+    if (tuneCycles > 1) {
+      tunePeriods += tuneTicks - tuneRise;
+      tuneAmplitudes += (tuneMax - tuneMin) / 2;
+    }
+    if (tuneCycles > THERMAL_TUNE_CYCLES) {
+      float a = tuneAmplitudes / THERMAL_TUNE_CYCLES;
+      float eps = THERMAL_TUNE_HYSTERESIS;
+      float amplitude = sqrtf(fmaxf(a * a - eps * eps, eps * eps));
+
+      /* relay of amplitude 0.5 around a duty of 0.5 */
+      ku = 4 * 0.5F / ((float)M_PI * amplitude);
+      pu = tunePeriods / THERMAL_TUNE_CYCLES * SAFETY_PERIOD / 1000.0F;
+      endAutotune(true);
+      return hysteresis(temperature, needed);
+    }
+    tuneCycles++;
+    tuneRise = tuneTicks;
+    tuneMax = temperature;
+    tuneMin = temperature;
+    on = true;
+  } else if (on && temperature > needed + THERMAL_TUNE_HYSTERESIS) {
+    on = false;
+  }
+  return on;
+}
+
+bool HeaterController::update(float temperature, float needed, float preview) {
+  bool valid = !isnan(temperature) && temperature != TEMP_ERROR;
+
+  if (on)
+    onTicks++;
+  if (++tick >= THERMAL_WINDOW_TICKS) {
+    /* a window mean would smear the dynamics the model fits, so the
+       reading at the end of the window is the sample */
+    model.update(valid ? temperature : NAN, (float)onTicks / THERMAL_WINDOW_TICKS);
+    tick = 0;
+    onTicks = 0;
+    mirrored = !mirrored;
+    if (valid)
+      startWindow(temperature, needed, preview);
+  }
+
+  /* the count first: a request newer than it is seen on the next tick */
+  uint8_t requests = tuneRequests;
+  uint8_t request = (requests != tuneHandled) ? tuneRequest : 0;
+  tuneHandled = requests;
+
+  if (request == 1 && mode != HEATER_AUTOTUNE) {
+    mode = HEATER_AUTOTUNE;
+    tuneResult = 0;
+    tuneTicks = 0;
+    tuneRise = 0;
+    tuneCycles = 0;
+    tunePeriods = 0;
+    tuneAmplitudes = 0;
+    on = false;
+  } else if (request == 2 && mode == HEATER_AUTOTUNE) {
+    endAutotune(false);
+  }
+
+  if (!valid) {
+    /* no heat without a temperature to judge it by */
+    on = false;
+    return false;
+  }
+
+  switch (mode) {
+    case HEATER_AUTOTUNE:
+      return autotune(temperature, needed);
+    case HEATER_PI:
+      /* every other window heats at its end, so that two pulses join
+         and the relay switches once per two windows */
+      if (mirrored)
+        on = tick >= (1 - duty) * THERMAL_WINDOW_TICKS;
+      else
+        on = tick < duty * THERMAL_WINDOW_TICKS;
+      if (temperature >= needed + THERMAL_GUARD)
+        on = false;
+      return on;
+    default:
+      return hysteresis(temperature, needed);
+  }
+}
@@ -0,0 +1,125 @@
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <stdint.h>
+
+#include "constants.h"
+
+/*
+ * Heater control from a first-order-plus-dead-time model of the
+ * chamber. Pure code without Arduino calls, so that tools/replay runs
+ * it against a trace.
+ *
+ * ThermalModel identifies the model from normal operation: once per
+ * THERMAL_WINDOW it fits T[k] = a T[k-1] + b u[k-d] + c by recursive
+ * least squares on the fused temperature at the end of window k and
+ * the heater duty u[k] in it, with one estimator per candidate dead
+ * time d. The one that predicts best is the model.
+ *
+ * HeaterController switches the heater on for a share of every window.
+ * The share is the steady-state duty of the setpoint one dead time
+ * ahead, so that the heat arrives together with a program step, plus
+ * a PI correction tuned from the model or by a relay-feedback
+ * autotune. Without a model or a tune it falls back to the plain
+ * hysteresis. Without a valid temperature (lost sensors, or a sample
+ * loop() did not republish in time) the heater is off.
+ */
+
+#define THERMAL_DELAYS (THERMAL_MAX_DELAY + 1)
+#define THERMAL_WINDOW_TICKS (THERMAL_WINDOW / SAFETY_PERIOD)
+
+/* words of the saved state: per estimator theta, the upper half of
+   cov, error and duty, then six more of the model and 18 of the
+   controller */
+#define THERMAL_MODEL_WORDS (THERMAL_DELAYS * 11 + 6)
+#define THERMAL_STATE_WORDS (THERMAL_MODEL_WORDS + 18)
+
+class ThermalModel {
+  public:
+    void begin();
+    void update(float temperature, float duty);
+    bool valid() const;
+    void state(uint32_t * words, bool restore);
+
+    float gain;       /* degrees above ambient at full duty */
+    float tau;        /* s */
+    float deadTime;   /* s */
+    float ambient;
+    uint32_t samples;
+
+  private:
+    void fit(int d, float x0, float y);
+
+    float theta[THERMAL_DELAYS][3];
+    float cov[THERMAL_DELAYS][3][3];
+    float error[THERMAL_DELAYS];
+    float duties[THERMAL_DELAYS];
+    float last;
+};
+
+enum HeaterMode {
+  HEATER_HYSTERESIS,
+  HEATER_AUTOTUNE,
+  HEATER_PI
+};
+
+class HeaterController {
+  public:
+    void begin();
+
+    /* every SAFETY_PERIOD; whether to heat */
+    bool update(float temperature, float needed, float preview);
+
+    /* all of the state but the autotune request, as
+       THERMAL_STATE_WORDS words: saved into words, or restored from
+       them so that tools/replay continues where the firmware was */
+    void state(uint32_t * words, bool restore);
+
+    /* right after the update() that started a window */
+    bool windowStarted() const { return tick == 0; }
+
+    /* from loop(); takes effect on the next update() */
+    void requestAutotune(bool start) {
+      tuneRequest = start ? 1 : 2;
+      tuneRequests = tuneRequests + 1;
+    }
+
+    HeaterMode mode;
+    ThermalModel model;
+    bool on;
+
+    float duty;
+    float kc;         /* duty per degree */
+    float ti;         /* s */
+    float ku;         /* ultimate gain and period of the last autotune */
+    float pu;
+    int8_t tuneResult;
+
+  private:
+    bool hysteresis(float temperature, float needed);
+    void startWindow(float temperature, float needed, float preview);
+    bool autotune(float temperature, float needed);
+    void endAutotune(bool done);
+
+    /* written by loop() only; update() notes the count it acted on */
+    volatile uint8_t tuneRequest;
+    volatile uint8_t tuneRequests;
+    uint8_t tuneHandled;
+
+    uint32_t tick;
+    uint32_t onTicks;
+    bool mirrored;
+    float integral;
+    float reference;
+    float previewReference;
+
+    uint32_t tuneTicks;
+    uint32_t tuneRise;
+    int tuneCycles;
+    float tuneMax;
+    float tuneMin;
+    float tunePeriods;
+    float tuneAmplitudes;
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "trace.h"
+
+#include "constants.h"
+#include "relays.h"
+#include "tracefmt.h"
+#include "zone.h"
+
+TraceStats traceStats;
+FlashRing traceRing;
+
+/*
+ * Largest keyframe: the sync record and five records per zone, with a
+ * time delta of at most two bytes as it is written in one go.
+ */
+#define KEYFRAME_SIZE (7 + N_ZONES * (4 + 13 + 8 + 4 + 13))
+
+static_assert(KEYFRAME_SIZE + TRACE_MAX_RECORD <= FLASH_RING_PAYLOAD,
+              "a trace page must hold the keyframe and one record");
+
+/* records come from loop() and from the safety timer interrupt */
+static uint8_t pages[2][FLASH_RING_PAYLOAD];
+static volatile uint8_t current = 0;
+static size_t len = 0;
+static volatile bool pending = false;
+
+/* heater state on its way out; the timer fills a zone's copy while
+   nothing of it is left to write */
+#define HEATER_CHUNKS \
+  (1 + (THERMAL_STATE_WORDS + TRACE_HEATER_CHUNK_WORDS - 1) / TRACE_HEATER_CHUNK_WORDS)
+
+static uint32_t heaterState[N_ZONES][THERMAL_STATE_WORDS];
+static uint32_t heaterTime[N_ZONES];
+static uint32_t heaterWindows[N_ZONES];
+static volatile uint8_t heaterLeft[N_ZONES];
+
+static uint32_t lastTime;
+static uint32_t lastProbe[N_ZONES][FUSION_MAX_PROBES];
+static uint32_t lastHumidity[N_ZONES];
+
+static void put(int type, int zone, const uint8_t * data, size_t n);
+
+static uint8_t relayMask(int zone) {
+  RelayStats stats;
+  uint8_t mask = 0;
+
+  for (int i = 0; i < nRelays; i++) {
+    relaySnapshot(i, stats);
+    if (stats.zone == zone && stats.on)
+      mask |= 1 << stats.kind;
+  }
+  return mask;
+}
+
+/* the keyframe every page starts with */
+static void startPage() {
+  uint8_t data[TRACE_MAX_RECORD];
+  size_t n;
+
+  lastTime = millis();
+  memset(lastProbe, 0, sizeof(lastProbe));
+  memset(lastHumidity, 0, sizeof(lastHumidity));
+
+  n = tracePutVarint(data, lastTime);
+  put(TRACE_SYNC, 0, data, n);
+
+  for (int i = 0; i < N_ZONES; i++) {
+    const ZoneConfig & cfg = zones[i].config();
+
+    data[0] = zones[i].nThermoSensors;
+    put(TRACE_ZONE, i, data, 1);
+
+    n = tracePutVarint(data, traceFloatBits(cfg.neededTemperature));
+    n += tracePutVarint(data + n, traceFloatBits(cfg.neededHumidity));
+    put(TRACE_CONFIG, i, data, n);
+
+    n = tracePutVarint(data, traceFloatBits(zones[i].previewTemperature));
+    put(TRACE_PREVIEW, i, data, n);
+
+    data[0] = relayMask(i);
+    put(TRACE_STATE, i, data, 1);
+
+    const HumidityController & humidifier = zones[i].climate.humidifier;
+    n = tracePutVarint(data, traceFloatBits(humidifier.gain));
+    n += tracePutVarint(data + n, traceFloatBits(humidifier.lossRate));
+    put(TRACE_LEARNED, i, data, n);
+  }
+}
+
+static void closePage() {
+  memset(pages[current] + len, 0xFF, FLASH_RING_PAYLOAD - len);
+  len = 0;
+
+  if (pending) {
+    traceStats.dropped++;
+    return;
+  }
+  pending = true;
+  current ^= 1;
+}
+
+static void put(int type, int zone, const uint8_t * data, size_t n) {
+  uint8_t * page = pages[current];
+  uint32_t now = millis();
+
+  page[len++] = (type << 4) | (zone & 0x0F);
+  len += tracePutVarint(page + len, type == TRACE_SYNC ? 0 : now - lastTime);
+  memcpy(page + len, data, n);
+  len += n;
+
+  lastTime = now;
+  traceStats.records++;
+}
+
+/*
+ * Makes room for one record, after the keyframe if it opens a page;
+ * KEYFRAME_SIZE + TRACE_MAX_RECORD fit an empty page. Call inside the
+ * critical section.
+ */
+static void reserve() {
+  if (len + TRACE_MAX_RECORD > FLASH_RING_PAYLOAD)
+    closePage();
+  if (len == 0)
+    startPage();
+}
+
+static void append(int type, int zone, const uint8_t * data, size_t n) {
+  core_util_critical_section_enter();
+  reserve();
+  put(type, zone, data, n);
+  core_util_critical_section_exit();
+}
+
+/* the next chunk of a zone's heater state, from loop() */
+static void writeHeaterChunk(int zone) {
+  uint8_t data[TRACE_MAX_RECORD];
+  int chunk = HEATER_CHUNKS - heaterLeft[zone];
+  size_t n;
+
+  data[0] = chunk;
+  if (chunk == 0) {
+    n = 1 + tracePutVarint(data + 1, millis() - heaterTime[zone]);
+    data[n++] = THERMAL_STATE_WORDS;
+  } else {
+    n = 1;
+    for (int i = 0; i < TRACE_HEATER_CHUNK_WORDS; i++) {
+      int word = (chunk - 1) * TRACE_HEATER_CHUNK_WORDS + i;
+      n += tracePutWord(data + n,
+        (word < THERMAL_STATE_WORDS) ? heaterState[zone][word] : 0);
+    }
+  }
+  append(TRACE_HEATER, zone, data, n);
+  heaterLeft[zone] = heaterLeft[zone] - 1;
+}
+
+void traceBegin() {
+  traceRing.begin(TRACE_FLASH_TOP, TRACE_FLASH_SIZE, TRACE_MAGIC);
+}
+
+/* writes a finished page to flash, from loop() only */
+void traceService() {
+  if (!traceRing.ready)
+    return;
+
+  /* a page that needs an erase waits if another ring erased this pass */
+  if (pending && traceRing.writable()) {
+    /* the interrupt does not switch pages while one is pending */
+    bool written = traceRing.append(pages[current ^ 1]);
+
+    core_util_critical_section_enter();
+    if (written)
+      traceStats.pages++;
+    else
+      traceStats.dropped++;
+    pending = false;
+    core_util_critical_section_exit();
+  }
+
+  /* the heater state fills at most one more page per pass */
+  for (int i = 0; i < N_ZONES; i++)
+    while (heaterLeft[i] > 0 && !pending)
+      writeHeaterChunk(i);
+}
+
+void traceFlush() {
+  core_util_critical_section_enter();
+  if (len > 0)
+    closePage();
+  core_util_critical_section_exit();
+  traceService();
+}
+
+/* from the safety timer, after the zone's heater update */
+void traceHeater(int zone, HeaterController & heating) {
+  if (zone >= N_ZONES || !heating.windowStarted() || heaterLeft[zone] > 0)
+    return;
+  if (heaterWindows[zone]++ % TRACE_HEATER_WINDOWS != 0)
+    return;
+
+  heating.state(heaterState[zone], false);
+  heaterTime[zone] = millis();
+  heaterLeft[zone] = HEATER_CHUNKS;
+}
+
+void traceProbe(int zone, int probe, float value) {
+  uint8_t data[TRACE_MAX_RECORD];
+  uint32_t bits = traceFloatBits(value);
+
+  if (zone >= N_ZONES || probe >= FUSION_MAX_PROBES)
+    return;
+
+  core_util_critical_section_enter();
+  reserve();
+  data[0] = probe;
+  size_t n = 1 + tracePutSigned(data + 1, bits - lastProbe[zone][probe]);
+  lastProbe[zone][probe] = bits;
+  put(TRACE_PROBE, zone, data, n);
+  core_util_critical_section_exit();
+}
+
+void traceHumidity(int zone, float value) {
+  uint8_t data[TRACE_MAX_RECORD];
+  uint32_t bits = traceFloatBits(value);
+
+  if (zone >= N_ZONES)
+    return;
+
+  core_util_critical_section_enter();
+  reserve();
+  size_t n = tracePutSigned(data, bits - lastHumidity[zone]);
+  lastHumidity[zone] = bits;
+  put(TRACE_HUMID, zone, data, n);
+  core_util_critical_section_exit();
+}
+
+void traceConfig(int zone, float neededTemperature, float neededHumidity) {
+  uint8_t data[TRACE_MAX_RECORD];
+
+  size_t n = tracePutVarint(data, traceFloatBits(neededTemperature));
+  n += tracePutVarint(data + n, traceFloatBits(neededHumidity));
+  append(TRACE_CONFIG, zone, data, n);
+}
+
+void tracePreview(int zone, float previewTemperature) {
+  uint8_t data[TRACE_MAX_RECORD];
+
+  size_t n = tracePutVarint(data, traceFloatBits(previewTemperature));
+  append(TRACE_PREVIEW, zone, data, n);
+}
+
+void traceTune(int zone, bool start) {
+  uint8_t data = start ? 1 : 0;
+  append(TRACE_TUNE, zone, &data, 1);
+}
+
+void traceRelay(int zone, int kind, bool on) {
+  uint8_t data = (kind << 1) | (on ? 1 : 0);
+  append(TRACE_RELAY, zone, &data, 1);
+}
+
+void traceButton(int button, bool pressed) {
+  uint8_t data = (button << 1) | (pressed ? 1 : 0);
+  append(TRACE_BUTTON, 0, &data, 1);
+}
+
+void traceReed(int zone, int sw, bool closed) {
+  uint8_t data = (sw << 1) | (closed ? 1 : 0);
+  append(TRACE_REED, zone, &data, 1);
+}
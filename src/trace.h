@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+#include "flashring.h"
+#include "thermal.h"
+
+/*
+ * Recorder of sensor samples, button and reed events, config changes
+ * and relay outputs. Records are packed (tracefmt.h) into a RAM page;
+ * full pages are written to a flash ring by traceService() from loop().
+ * The record functions may be called before traceBegin() and from
+ * interrupt context.
+ */
+
+typedef struct {
+  uint32_t records;
+  uint32_t pages;
+  uint32_t dropped;
+} TraceStats;
+
+extern TraceStats traceStats;
+extern FlashRing traceRing;
+
+void traceBegin();
+void traceService();
+void traceFlush();
+
+void traceProbe(int zone, int probe, float value);
+void traceHumidity(int zone, float value);
+void traceConfig(int zone, float neededTemperature, float neededHumidity);
+void tracePreview(int zone, float previewTemperature);
+void traceTune(int zone, bool start);
+void traceHeater(int zone, HeaterController & heating);
+void traceRelay(int zone, int kind, bool on);
+void traceButton(int button, bool pressed);
+void traceReed(int zone, int sw, bool closed);
+
+#endif
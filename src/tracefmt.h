@@ -0,0 +1,119 @@
+#ifndef TRACEFMT_H
+#define TRACEFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Record format of the trace, shared by the firmware (trace.cpp) and
+ * the host replay (tools/replay). A page is a stream of records; each
+ * starts with a byte of type << 4 | zone and the varint milliseconds
+ * since the previous record. Sensor values are zigzag varint deltas to
+ * the previous value of the same channel in the page. Every page opens
+ * with a keyframe (sync, zone, config and state records), so a page
+ * decodes without the ones before it.
+ *
+ * The heater state (HeaterController::state) is larger than a page, so
+ * it is not part of every keyframe: every TRACE_HEATER_WINDOWS windows
+ * it goes out as a run of TRACE_HEATER chunks. Chunk 0 holds the varint
+ * age of the state in ms and a byte count of its words, chunk n > 0
+ * words 2n - 2 and 2n - 1, 4 bytes each, least significant first.
+ */
+
+enum TraceType {
+  TRACE_SYNC = 0,   /* varint uptime in ms */
+  TRACE_ZONE,       /* byte number of DS18B20 probes */
+  TRACE_CONFIG,     /* varint temperature, varint humidity */
+  TRACE_STATE,      /* byte bitmask of the relays that are on */
+  TRACE_PROBE,      /* byte probe, zigzag delta of the temperature */
+  TRACE_HUMID,      /* zigzag delta of the humidity */
+  TRACE_RELAY,      /* byte kind << 1 | on */
+  TRACE_BUTTON,     /* byte button << 1 | pressed */
+  TRACE_REED,       /* byte switch << 1 | closed */
+  TRACE_LEARNED,    /* varint wetter gain, varint loss rate */
+  TRACE_PREVIEW,    /* varint setpoint one heater dead time ahead */
+  TRACE_TUNE,       /* byte 1 start or 0 stop of a heater autotune */
+  TRACE_HEATER,     /* byte chunk of the heater state, see below */
+  TRACE_PAD = 0x0F  /* erased flash: end of the page */
+};
+
+/* relays of a zone, as numbered in TRACE_RELAY and TRACE_STATE */
+enum RelayKind {
+  RELAY_MOTOR_P = 0,
+  RELAY_MOTOR_M,
+  RELAY_WETTER,
+  RELAY_COOLER,
+  RELAY_HEATER,
+  RELAY_RING,
+  RELAY_VENTIL,
+  N_RELAY_KINDS
+};
+
+#define TRACE_MAX_RECORD 16
+#define TRACE_MAX_ZONES 16
+#define TRACE_HEATER_CHUNK_WORDS 2
+
+static inline uint32_t traceFloatBits(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static inline float traceBitsFloat(uint32_t bits) {
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static inline size_t tracePutWord(uint8_t * p, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    p[i] = value >> (8 * i);
+  return 4;
+}
+
+static inline uint32_t traceGetWord(const uint8_t * p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline size_t tracePutVarint(uint8_t * p, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    p[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  p[n++] = value;
+  return n;
+}
+
+static inline size_t tracePutSigned(uint8_t * p, int32_t value) {
+  return tracePutVarint(p, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+/* false if the varint runs past end */
+static inline bool traceGetVarint(const uint8_t ** p, const uint8_t * end,
+                                  uint32_t * value)
+{
+  uint32_t result = 0;
+  for (int shift = 0; *p < end && shift < 35; shift += 7) {
+    uint8_t b = *(*p)++;
+    result |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool traceGetSigned(const uint8_t ** p, const uint8_t * end,
+                                  int32_t * value)
+{
+  uint32_t raw;
+  if (!traceGetVarint(p, end, &raw))
+    return false;
+  *value = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+  return true;
+}
+
+#endif
@@ -0,0 +1,520 @@
+#include "zone.h"
+
+#include <drivers/DSTherm.h>
+
+#include "constants.h"
+#include "trace.h"
+
+Zone zones[N_ZONES];
+
+void Zone::begin(int number, const ZonePins * pins) {
+  this->number = number;
+  this->pins = pins;
+
+  currentTemperature = 0;
+  currentHumidity = 0;
+  previewTemperature = 0;
+  alarm = false;
+
+  /* before the first config change, which starts a trace keyframe */
+  climate.begin(millis());
+
+  thermal.seq = 0;
+  safeSample.temperature = currentTemperature;
+  safeSample.neededTemperature = 0;
+  safeSample.previewTemperature = 0;
+  safeSample.time = millis();
+  thermalPublish(thermal, safeSample);
+  thermalStale = false;
+  staleCount = 0;
+  staleLogged = 0;
+  staleOpen = false;
+  tuneLogged = false;
+
+  ZoneConfig initial;
+  initial.neededTemperature = 37.5;
+  initial.neededHumidity = 50;
+  initial.rotationsPerDay = 12;
+  activeConfig = 0;
+  commitConfig(initial);
+
+  currentProgramNumber = 0;
+  currentSegment = -1;
+  currentProgram = ProgramEntry();
+
+  needRotate = false;
+  hasChanges = false;
+  wetting = false;
+  thermoSensorTimer = 0;
+  humiditySensorTimer = 0;
+  temperatureSeen = millis();
+  humiditySeen = millis();
+  temperatureLost = false;
+  humidityLost = false;
+  fusionUs = 0;
+  fusionMaxUs = 0;
+
+  relayAttach(pins->motorP, number, RELAY_MOTOR_P);
+  relayAttach(pins->motorM, number, RELAY_MOTOR_M);
+  relayAttach(pins->wetter, number, RELAY_WETTER);
+  relayAttach(pins->cooler, number, RELAY_COOLER);
+  relayAttach(pins->heater, number, RELAY_HEATER);
+  relayAttach(pins->ring, number, RELAY_RING);
+  relayAttach(pins->ventil, number, RELAY_VENTIL);
+
+  relayWrite(pins->motorP, OFF);
+  relayWrite(pins->motorM, OFF);
+  relayWrite(pins->wetter, OFF);
+  relayWrite(pins->cooler, ON);
+  relayWrite(pins->heater, OFF);
+  relayWrite(pins->ring, OFF);
+  relayWrite(pins->ventil, OFF);
+
+  initReedSwitches();
+  initSensors();
+
+  pos = determinePosition();
+  rotateTo = pos;
+
+  rotateTimer = millis();
+  beginTimer = millis();
+}
+
+void Zone::initReedSwitches() {
+  if (!hasTurner())
+    return;
+
+  posm45.attach(pins->posM45, INPUT);
+  posm45.interval(REED_SWITCH_DELAY);
+
+  posn00.attach(pins->posN00, INPUT);
+  posn00.interval(REED_SWITCH_DELAY);
+
+  posp45.attach(pins->posP45, INPUT);
+  posp45.interval(REED_SWITCH_DELAY);
+}
+
+void Zone::initSensors() {
+  OneWireNg::ErrorCode error;
+
+  new (&onewire) OneWireNg_CurrentPlatform(pins->ds, false);
+
+  DSTherm thermoSensor(onewire);
+
+  thermoSensor.writeScratchpadAll(0, 0, DSTherm::RES_X_BIT);
+
+  (&onewire)->searchReset();
+  nThermoSensors = 0;
+  do {
+    error = (&onewire)->search(addresses[nThermoSensors]);
+    if (error == OneWireNg::EC_SUCCESS || error == OneWireNg::EC_DONE)
+      nThermoSensors++;
+  } while (error == OneWireNg::EC_SUCCESS && nThermoSensors < MAX_THERMO_PROBES);
+
+  thermoSensorConnected = nThermoSensors > 0;
+
+  /* DS18B20 probes first, the DHT22 temperature channel last */
+  thermoFusion.begin(nThermoSensors + 1);
+  thermoFusion.setWeight(nThermoSensors, FUSION_DHT_WEIGHT);
+
+  new (&humiditySensor) DHT(pins->dht, DHT22);
+  (&humiditySensor)->begin();
+}
+
+void Zone::correctPosition() {
+  if (!hasTurner())
+    return;
+
+  uint32_t posTimer = millis();
+  pos = determinePosition();
+
+  if (pos == M) {
+    rotateRight();
+    rotateTo = P;
+  } else {
+    rotateLeft();
+    rotateTo = M;
+  }
+
+  while ((millis() - posTimer) <= ROTATION_PERIOD) {
+    posm45.update();
+    posn00.update();
+    posp45.update();
+    if (determinePosition() == rotateTo)
+      break;
+  }
+  rotateOff();
+  rotateTimer = millis();
+}
+
+void Zone::update() {
+  if (hasTurner()) {
+    Bounce * reeds[] = {&posm45, &posn00, &posp45};
+    for (int i = 0; i < 3; i++)
+      if (reeds[i]->update())
+        traceReed(number, i, reeds[i]->read());
+  }
+
+  pos = determinePosition();
+
+  fusionUs = 0;
+  updateCurrentHumidity();
+  updateCurrentTemperature();
+  updateProgram();
+  updateClimate();
+  logSafety();
+  updateTurner();
+}
+
+void Zone::rotateLeft() {
+  relayWrite(pins->motorP, OFF);
+  relayWrite(pins->motorM, ON);
+}
+
+void Zone::rotateRight() {
+  relayWrite(pins->motorP, ON);
+  relayWrite(pins->motorM, OFF);
+}
+
+void Zone::rotateOff() {
+  relayWrite(pins->motorP, OFF);
+  relayWrite(pins->motorM, OFF);
+}
+
+/* may be called from interrupt context */
+void Zone::forceSafe() {
+  relayWrite(pins->heater, OFF);
+  relayWrite(pins->wetter, OFF);
+  relayWrite(pins->cooler, ON);
+  rotateOff();
+}
+
+bool Zone::hasTurner() {
+  return pins->motorP != NO_PIN && pins->motorM != NO_PIN;
+}
+
+const char * validateConfig(const ZoneConfig & config) {
+  if (!(config.neededTemperature >= MIN_TEMPERATURE
+        && config.neededTemperature <= MAX_TEMPERATURE))
+    return "needed_temp";
+  if (!(config.neededHumidity >= MIN_HUMIDITY
+        && config.neededHumidity <= MAX_HUMIDITY))
+    return "needed_humid";
+  if (config.rotationsPerDay > MAX_ROT_PER_DAY)
+    return "rotations_per_day";
+  return NULL;
+}
+
+const char * Zone::commitConfig(ZoneConfig config) {
+  const char * error = validateConfig(config);
+  if (error)
+    return error;
+
+  if (config.rotationsPerDay > 0)
+    config.period = DAY / config.rotationsPerDay;
+  else
+    config.period = NO_PERIOD;
+
+  uint8_t spare = activeConfig ^ 1;
+  configs[spare] = config;
+  activeConfig = spare;
+
+  traceConfig(number, config.neededTemperature, config.neededHumidity);
+  eventRecord(number, EVENT_CONFIG, config.neededTemperature * 100);
+  return NULL;
+}
+
+void Zone::updateCurrentTemperature() {
+  Placeholder<DSTherm::Scratchpad> sp_place;
+  DSTherm::Scratchpad * sp;
+  DSTherm thermoSensor(onewire);
+  uint32_t now = millis();
+  uint32_t fusionStart;
+
+  if (!thermoSensorConnected) {
+    /* nothing to do, the DHT22 alone feeds the fusion */
+  } else if (!thermoSensorTimer) {
+    thermoSensor.convertTempAll(DSTherm::SCAN_BUS, false);
+    thermoSensorTimer = now;
+  } else if ((now - thermoSensorTimer) >= CONVERSION_TIME) {
+    for (int i = 0; i < nThermoSensors; i++) {
+      if (thermoSensor.readScratchpad(addresses[i], &sp_place)
+          != OneWireNg::EC_SUCCESS)
+        continue;
+      sp = &sp_place;
+
+      float value = (sp->getTemp()) / 1000.0F;
+      traceProbe(number, i, value);
+
+      fusionStart = micros();
+      thermoFusion.sample(i, value, now);
+      fusionUs += micros() - fusionStart;
+    }
+
+    thermoSensorTimer = 0;
+  }
+
+  fusionStart = micros();
+  thermoFusion.update(now);
+  fusionUs += micros() - fusionStart;
+
+  if (fusionUs > fusionMaxUs)
+    fusionMaxUs = fusionUs;
+
+  currentTemperature = thermoFusion.valid ? thermoFusion.value : TEMP_ERROR;
+  checkSensor(thermoFusion.valid, temperatureSeen, temperatureLost,
+              EVENT_TEMP_LOST, EVENT_TEMP_BACK);
+}
+
+void Zone::updateCurrentHumidity() {
+  uint32_t now = millis();
+
+  if (humiditySensorTimer && (now - humiditySensorTimer) < DHT_PERIOD)
+    return;
+  humiditySensorTimer = now;
+
+  currentHumidity = (&humiditySensor)->readHumidity();
+  traceHumidity(number, currentHumidity);
+  checkSensor(!isnan(currentHumidity), humiditySeen, humidityLost,
+              EVENT_HUMID_LOST, EVENT_HUMID_BACK);
+
+  float temperature = (&humiditySensor)->readTemperature();
+  traceProbe(number, nThermoSensors, temperature);
+
+  uint32_t fusionStart = micros();
+  thermoFusion.sample(nThermoSensors, temperature, now);
+  fusionUs += micros() - fusionStart;
+}
+
+/* logs a sensor that gave nothing valid for SENSOR_LOST_TIME, and its return */
+void Zone::checkSensor(bool valid, uint32_t & seen, bool & lost,
+                       EventType lostType, EventType backType)
+{
+  uint32_t now = millis();
+
+  if (valid) {
+    seen = now;
+    if (lost) {
+      lost = false;
+      eventRecord(number, backType, 0);
+    }
+  } else if (!lost && (now - seen) >= SENSOR_LOST_TIME) {
+    lost = true;
+    eventRecord(number, lostType, 0);
+  }
+}
+
+void Zone::updateProgram() {
+  for (int i = 0; i < currentProgram.length; i++) {
+    if (currentProgram.type != TYPE_AUTO)
+      break;
+    uint32_t currentTime = millis() - beginTimer;
+    if (
+          (currentTime >= currentProgram.program[i].begin)
+       && (currentTime <= currentProgram.program[i].end)
+       )
+    {
+      const ProgramRecord & record = currentProgram.program[i];
+      const ZoneConfig & current = config();
+      if (currentSegment != i)
+        eventRecord(number, EVENT_SEGMENT, i);
+      currentSegment = i;
+      if (current.neededTemperature == record.neededTemp
+          && current.neededHumidity == record.neededHumid
+          && current.rotationsPerDay == (uint32_t)record.rotationsPerDay)
+        continue;
+
+      ZoneConfig next;
+      next.neededTemperature = record.neededTemp;
+      next.neededHumidity = record.neededHumid;
+      next.rotationsPerDay = record.rotationsPerDay;
+      commitConfig(next);
+    }
+  }
+}
+
+/* the program setpoint one heater dead time from now */
+float Zone::lookAhead(float neededTemperature) {
+  if (currentProgram.type != TYPE_AUTO)
+    return neededTemperature;
+
+  uint32_t ahead = millis() - beginTimer
+    + (uint32_t)(climate.heating.model.deadTime * 1000);
+  for (int i = 0; i < currentProgram.length; i++) {
+    const ProgramRecord & record = currentProgram.program[i];
+    if (ahead >= record.begin && ahead <= record.end)
+      return record.neededTemp;
+  }
+  return neededTemperature;
+}
+
+void Zone::updateClimate() {
+  ZoneConfig cfg = config();
+  ThermalSample sample;
+
+  float preview = lookAhead(cfg.neededTemperature);
+  if (preview != previewTemperature)
+    tracePreview(number, preview);
+  previewTemperature = preview;
+
+  sample.temperature = currentTemperature;
+  sample.neededTemperature = cfg.neededTemperature;
+  sample.previewTemperature = preview;
+  sample.time = millis();
+  thermalPublish(thermal, sample);
+
+  climate.updateHumidity(currentHumidity, cfg.neededHumidity, millis());
+
+  if (climate.ring != alarm)
+    eventRecord(number, climate.ring ? EVENT_OVERHEAT : EVENT_OVERHEAT_END,
+                currentTemperature * 100);
+  alarm = climate.ring;
+  wetting = climate.wetter;
+
+  relayWrite(pins->wetter, climate.wetter ? ON : OFF);
+}
+
+/*
+ * Logs what the safety timer saw since the last pass. A stale episode
+ * that ended before loop() got here is still logged.
+ */
+void Zone::logSafety() {
+  uint32_t count = staleCount;
+
+  if (count != staleLogged) {
+    eventRecord(number, EVENT_SAFETY_STALE, count - staleLogged);
+    staleLogged = count;
+    staleOpen = true;
+  }
+  if (staleOpen && !thermalStale) {
+    eventRecord(number, EVENT_SAFETY_FRESH, 0);
+    staleOpen = false;
+  }
+
+  bool tuning = climate.heating.mode == HEATER_AUTOTUNE;
+  if (tuning != tuneLogged)
+    eventRecord(number, EVENT_AUTOTUNE, tuning ? 0 : climate.heating.tuneResult);
+  tuneLogged = tuning;
+}
+
+/*
+ * Runs from the safety timer. A sample that was not republished within
+ * SAFETY_STALE_TIME counts as a sensor failure, and the heater stays
+ * off until a fresh one arrives.
+ */
+void Zone::safetyUpdate(uint32_t now) {
+  if (!thermalRead(thermal, safeSample))
+    safetyStats.torn++;
+
+  float temperature = safeSample.temperature;
+  bool stale = (now - safeSample.time) >= SAFETY_STALE_TIME;
+  if (stale) {
+    temperature = TEMP_ERROR;
+    safetyStats.stale++;
+  }
+  if (stale != thermalStale) {
+    thermalStale = stale;
+    if (stale)
+      staleCount = staleCount + 1;
+  }
+
+  climate.updateThermal(temperature, safeSample.neededTemperature,
+                        safeSample.previewTemperature);
+  traceHeater(number, climate.heating);
+
+  relayWrite(pins->heater, climate.heater ? ON : OFF);
+  relayWrite(pins->ring, climate.ring ? ON : OFF);
+  relayWrite(pins->ventil, climate.ventil ? ON : OFF);
+}
+
+void Zone::updateTurner() {
+  if (!hasTurner())
+    return;
+
+  ZoneConfig cfg = config();
+
+  if (((millis() - rotateTimer) >= cfg.period) && (cfg.period != NO_PERIOD) && (!needRotate)) {
+    if (pos == M || pos == N) {
+      rotateTo = P;
+      needRotate = true;
+    } else if (pos == P || pos == Undefined) {
+      rotateTo = M;
+      needRotate = true;
+    }
+
+  } else if (cfg.period == NO_PERIOD) {
+    if (pos != N) {
+      rotateTo = N;
+      needRotate = true;
+      rotateTimer = millis();
+
+      if (pos == P) {
+        rotateLeft();
+        if (determinePosition() == rotateTo
+            || (millis() - rotateTimer) >= cfg.period + ROTATION_PERIOD)
+        {
+          rotateOff();
+        }
+      } else if (pos == M) {
+        rotateRight();
+        if (determinePosition() == rotateTo
+            || (millis() - rotateTimer) >= cfg.period + ROTATION_PERIOD)
+        {
+          rotateOff();
+        }
+      }
+    }
+
+  }
+
+  if (needRotate) {
+    if (rotateTo == P) {
+      rotateRight();
+    } else if (rotateTo == M) {
+      rotateLeft();
+    }
+    if (determinePosition() == rotateTo
+        || (millis() - rotateTimer) >= cfg.period + ROTATION_PERIOD)
+    {
+        if (determinePosition() != rotateTo)
+          eventRecord(number, EVENT_TURNER_TIMEOUT, rotateTo);
+        rotateOff();
+        rotateTo = Undefined;
+        rotateTimer = millis();
+        needRotate = false;
+      }
+  }
+}
+
+Position Zone::determinePosition() {
+  if (!hasTurner())
+    return Undefined;
+
+  bool m45 = !posm45.read();
+  bool n00 = posn00.read();
+  bool p45 = !posp45.read();
+
+  if (!m45 && !n00 && !p45) {
+    return Undefined;
+  }
+
+  if (m45 && !(n00 || p45)) {
+    return M;
+  } else if (n00 && !(m45 || p45)) {
+    return N;
+  } else if (p45 && !(m45 || n00)) {
+    return P;
+  }
+
+  return PosError;
+}
+
+void Zone::loadProgram(int n_program) {
+  currentProgramNumber = n_program;
+  currentSegment = -1;
+  eventRecord(number, EVENT_PROGRAM, n_program);
+  currentProgram.type = programIndex[n_program + 1].type;
+  currentProgram.length = programIndex[n_program + 1].length;
+  for (int i = 0; i < MAX_PROGRAM_LEN; i++)
+    currentProgram.program[i] = programIndex[n_program + 1].program[i];
+}
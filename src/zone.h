@@ -0,0 +1,138 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <Arduino.h>
+#include <Bounce2.h>
+#include <DHT.h>
+
+#include <OneWireNg_CurrentPlatform.h>
+#include <utils/Placeholder.h>
+
+#include "pins.h"
+#include "automode.h"
+#include "climate.h"
+#include "constants.h"
+#include "events.h"
+#include "fusion.h"
+#include "relays.h"
+#include "safety.h"
+
+enum Position {
+  M = -1, N, P, PosError, Undefined
+};
+
+/*
+ * Setpoints of a zone. The control loop reads the active copy; changes
+ * are validated as a whole into the spare copy, which then becomes
+ * active, so a half-applied change is never visible.
+ */
+typedef struct {
+  float neededTemperature;
+  float neededHumidity;
+  uint32_t rotationsPerDay;
+  uint32_t period;
+} ZoneConfig;
+
+/* returns the name of the first invalid setting or NULL */
+const char * validateConfig(const ZoneConfig & config);
+
+/*
+ * Controller of one incubator zone: its own sensors, relays, program
+ * state and turner. The board drives all zones from zones[] in loop().
+ */
+class Zone {
+  public:
+    void begin(int number, const ZonePins * pins);
+    void correctPosition();
+    void update();
+
+    void rotateLeft();
+    void rotateRight();
+    void rotateOff();
+    void forceSafe();
+    void safetyUpdate(uint32_t now);
+
+    bool hasTurner();
+    Position determinePosition();
+
+    void loadProgram(int n_program);
+
+    const ZoneConfig & config() { return configs[activeConfig]; }
+    const char * commitConfig(ZoneConfig config);
+
+    int number;
+    const ZonePins * pins;
+
+    float currentTemperature;
+    float currentHumidity;
+    /* setpoint one heater dead time ahead, see thermal.h */
+    float previewTemperature;
+
+    bool alarm;
+
+    int currentProgramNumber;
+    int currentSegment;
+    ProgramEntry currentProgram;
+
+    bool needRotate;
+    bool hasChanges;
+    bool wetting;
+
+    bool thermoSensorConnected;
+    int nThermoSensors;
+
+    SensorFusion thermoFusion;
+    uint32_t fusionUs;
+    uint32_t fusionMaxUs;
+
+    ClimateController climate;
+    ThermalSnapshot thermal;
+
+    Position pos;
+    Position rotateTo;
+
+    uint32_t rotateTimer;
+    uint32_t beginTimer;
+    uint32_t thermoSensorTimer;
+    uint32_t humiditySensorTimer;
+
+  private:
+    ZoneConfig configs[2];
+    volatile uint8_t activeConfig;
+
+    ThermalSample safeSample;
+
+    /* set by the safety timer, logged from loop() */
+    volatile bool thermalStale;
+    volatile uint32_t staleCount;
+    uint32_t staleLogged;
+    bool staleOpen;
+    bool tuneLogged;
+
+    uint32_t temperatureSeen;
+    uint32_t humiditySeen;
+    bool temperatureLost;
+    bool humidityLost;
+
+    void initReedSwitches();
+    void initSensors();
+    void checkSensor(bool valid, uint32_t & seen, bool & lost,
+                     EventType lostType, EventType backType);
+
+    void updateCurrentTemperature();
+    void updateCurrentHumidity();
+    void updateProgram();
+    float lookAhead(float neededTemperature);
+    void updateClimate();
+    void logSafety();
+    void updateTurner();
+
+    Bounce posm45, posn00, posp45;
+    Placeholder<DHT> humiditySensor;
+    Placeholder<OneWireNg_CurrentPlatform> onewire;
+    OneWireNg::Id addresses[MAX_THERMO_PROBES];
+};
+
+extern Zone zones[N_ZONES];
+
+#endif
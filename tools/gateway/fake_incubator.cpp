@@ -0,0 +1,240 @@
+/*
+ * Simulator of the incubator's HTTP /control endpoint for exercising
+ * the gateway without hardware. Listens on COUNT consecutive ports
+ * starting at PORT, each playing one incubator. With -d every unit
+ * whose index is a multiple of -s answers DELAY ms late. With -c every
+ * unit whose index is a multiple of CUT closes the connection half way
+ * through the body, as a unit that resets while replying does.
+ *
+ * Usage: fake_incubator [-d delay_ms] [-s slow_every] [-c cut_every]
+ *                       port [count]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define RX_SIZE 1024
+#define TX_SIZE 1024
+#define MAX_EVENTS 64
+
+struct Listener {
+  int fd;
+  int index;
+};
+
+struct Connection {
+  int fd;
+  int index;
+  char rx[RX_SIZE];
+  size_t rxLen;
+  uint64_t replyAt;
+};
+
+static int epfd;
+static int cutEvery = 0;
+static std::vector<Connection *> pending;
+
+static uint64_t monotonicMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void closeConnection(Connection * c) {
+  close(c->fd);
+  delete c;
+}
+
+static size_t answer(Connection * c, char * body, size_t size) {
+  size_t len = 0;
+  int zone = 0;
+  const char * p = strstr(c->rx, "\r\n\r\n") + 4;
+
+  while (*p) {
+    const char * eol = strchr(p, '\n');
+    if (!eol)
+      eol = p + strlen(p);
+    size_t n = eol - p;
+    if (n && p[n - 1] == '\r')
+      n--;
+
+    if (n > 5 && strncmp(p, "zone ", 5) == 0) {
+      zone = atoi(p + 5);
+      len += snprintf(body + len, size - len, "success\r\n");
+    } else if (n == 13 && strncmp(p, "request_state", n) == 0) {
+      uint64_t t = monotonicMs() / 1000;
+      len += snprintf(body + len, size - len,
+        "current_temp %.2f\r\n"
+        "current_humid %.2f\r\n"
+        "heater %d\r\n"
+        "cooler 1\r\n"
+        "wetter 0\r\n"
+        "chamber %d\r\n"
+        "uptime %llu\r\n"
+        "zone %d\r\n",
+        37.5 + 0.01 * ((c->index * 7 + t) % 30),
+        50.0 + (c->index + t) % 5,
+        (int)(t % 2),
+        (int)(t % 3) - 1,
+        (unsigned long long)t,
+        zone);
+    } else if (n == 14 && strncmp(p, "request_config", n) == 0) {
+      len += snprintf(body + len, size - len,
+        "needed_temp 37.50\r\n"
+        "needed_humid 50.00\r\n"
+        "rotation_per_day 12\r\n"
+        "number_of_programs 2\r\n"
+        "current_program 0\r\n"
+        "number_of_zones 1\r\n");
+    }
+
+    p = *eol ? eol + 1 : eol;
+  }
+
+  return len;
+}
+
+static void reply(Connection * c) {
+  char body[TX_SIZE / 2];
+  char tx[TX_SIZE];
+
+  size_t bodyLen = answer(c, body, sizeof(body));
+  int len = snprintf(tx, sizeof(tx),
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: %zu\r\n"
+    "\r\n"
+    "%.*s\r\n",
+    bodyLen + 2, (int)bodyLen, body);
+  if (cutEvery && c->index % cutEvery == 0)
+    len -= (bodyLen + 2) / 2;
+
+  send(c->fd, tx, len, MSG_NOSIGNAL);
+  closeConnection(c);
+}
+
+static bool complete(Connection * c) {
+  const char * body = strstr(c->rx, "\r\n\r\n");
+  return body && c->rxLen >= 2 && c->rx[c->rxLen - 1] == '\n'
+    && body + 4 < c->rx + c->rxLen;
+}
+
+int main(int argc, char ** argv) {
+  int delay = 0, slowEvery = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:s:c:")) != -1) {
+    switch (opt) {
+      case 'd': delay = atoi(optarg); break;
+      case 's': slowEvery = atoi(optarg); break;
+      case 'c': cutEvery = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: fake_incubator [-d delay_ms] "
+          "[-s slow_every] [-c cut_every] port [count]\n");
+        return 2;
+    }
+  }
+  if (optind >= argc || slowEvery <= 0 || cutEvery < 0)
+    return 2;
+
+  int port = atoi(argv[optind]);
+  int count = optind + 1 < argc ? atoi(argv[optind + 1]) : 1;
+
+  epfd = epoll_create1(0);
+  std::vector<Listener> listeners(count);
+
+  for (int i = 0; i < count; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port + i);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+      perror("bind");
+      return 1;
+    }
+
+    listeners[i].fd = fd;
+    listeners[i].index = i;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listeners[i];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  epoll_event events[MAX_EVENTS];
+
+  for (;;) {
+    uint64_t now = monotonicMs();
+    int timeout = -1;
+
+    for (size_t i = 0; i < pending.size();) {
+      if (pending[i]->replyAt <= now) {
+        reply(pending[i]);
+        pending[i] = pending.back();
+        pending.pop_back();
+      } else {
+        int left = (int)(pending[i]->replyAt - now);
+        if (timeout < 0 || left < timeout)
+          timeout = left;
+        i++;
+      }
+    }
+
+    int n = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+      void * ptr = events[i].data.ptr;
+      bool isListener = ptr >= (void *)listeners.data()
+        && ptr < (void *)(listeners.data() + listeners.size());
+
+      if (isListener) {
+        Listener * l = (Listener *)ptr;
+        int fd;
+        while ((fd = accept4(l->fd, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+          Connection * c = new Connection();
+          c->fd = fd;
+          c->index = l->index;
+          epoll_event ev = {};
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        continue;
+      }
+
+      Connection * c = (Connection *)ptr;
+      ssize_t got = recv(c->fd, c->rx + c->rxLen,
+        sizeof(c->rx) - 1 - c->rxLen, 0);
+      if (got <= 0) {
+        if (got < 0 && errno == EAGAIN)
+          continue;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+        closeConnection(c);
+        continue;
+      }
+      c->rxLen += got;
+      c->rx[c->rxLen] = '\0';
+
+      if (complete(c)) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+        int lag = (delay && c->index % slowEvery == 0) ? delay : 0;
+        c->replyAt = monotonicMs() + lag;
+        pending.push_back(c);
+      }
+    }
+  }
+}
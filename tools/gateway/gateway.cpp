@@ -0,0 +1,426 @@
+/*
+ * Fleet gateway: polls the /control endpoint of many incubators
+ * concurrently from a single epoll loop and appends every reply to a
+ * time-series file, one line per sample:
+ *
+ *   <unix ms>\t<unit>\t<key>=<value>\t<key>=<value>...
+ *
+ * Usage: gateway [-i interval_ms] [-t timeout_ms] [-n rounds]
+ *                [-o file] host[:port][/zone]...
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "protocol.h"
+
+#define DEFAULT_PORT 80
+#define DEFAULT_INTERVAL 10000
+#define DEFAULT_TIMEOUT 5000
+
+#define RX_SIZE 2048
+#define TX_SIZE 160
+#define OUT_SIZE 65536
+#define MAX_EVENTS 64
+
+enum UnitState {
+  UNIT_IDLE,
+  UNIT_CONNECTING,
+  UNIT_SENDING,
+  UNIT_RECEIVING
+};
+
+struct Unit {
+  char name[64];
+  sockaddr_in addr;
+  int zone;
+
+  int fd;
+  UnitState state;
+  uint64_t nextPoll;
+  uint64_t deadline;
+  long rounds;
+
+  char tx[TX_SIZE];
+  size_t txLen, txSent;
+  char rx[RX_SIZE];
+  size_t rxLen;
+
+  unsigned long polls, failures;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static int epfd = -1;
+static int outFd = -1;
+static char out[OUT_SIZE];
+static size_t outLen = 0;
+
+static uint64_t monotonicMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t realtimeMs() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void flushOutput() {
+  size_t done = 0;
+  while (done < outLen) {
+    ssize_t n = write(outFd, out + done, outLen - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("write");
+      break;
+    }
+    done += n;
+  }
+  outLen = 0;
+}
+
+static void append(const char * data, size_t len) {
+  if (outLen + len > sizeof(out))
+    flushOutput();
+  if (len > sizeof(out))
+    len = sizeof(out);
+  memcpy(out + outLen, data, len);
+  outLen += len;
+}
+
+static bool parseUnit(const char * spec, Unit & unit) {
+  char host[64];
+  const char * colon = strchr(spec, ':');
+  const char * slash = strchr(spec, '/');
+  const char * hostEnd = colon ? colon : (slash ? slash : spec + strlen(spec));
+  int port = DEFAULT_PORT;
+
+  if ((size_t)(hostEnd - spec) >= sizeof(host))
+    return false;
+  memcpy(host, spec, hostEnd - spec);
+  host[hostEnd - spec] = '\0';
+
+  if (colon)
+    port = atoi(colon + 1);
+  unit.zone = slash ? atoi(slash + 1) : -1;
+
+  addrinfo hints = {}, * res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, nullptr, &hints, &res) != 0)
+    return false;
+  unit.addr = *(sockaddr_in *)res->ai_addr;
+  unit.addr.sin_port = htons(port);
+  freeaddrinfo(res);
+
+  snprintf(unit.name, sizeof(unit.name), "%s", spec);
+  return true;
+}
+
+static void buildRequest(Unit & unit) {
+  char body[64];
+  char zone[24] = "";
+  if (unit.zone >= 0)
+    snprintf(zone, sizeof(zone), "zone %d\r\n", unit.zone);
+
+  int len = snprintf(body, sizeof(body),
+    "%srequest_state\r\n"
+    "request_config\r\n",
+    zone);
+  unit.txLen = snprintf(unit.tx, sizeof(unit.tx),
+    "POST /control HTTP/1.1\r\n"
+    "Content-Length: %d\r\n"
+    "\r\n"
+    "%s",
+    len, body);
+}
+
+static void closeUnit(Unit & unit) {
+  if (unit.fd >= 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, unit.fd, nullptr);
+    close(unit.fd);
+  }
+  unit.fd = -1;
+  unit.state = UNIT_IDLE;
+}
+
+static void finishPoll(Unit & unit, bool ok) {
+  unit.polls++;
+  if (!ok)
+    unit.failures++;
+  unit.rounds--;
+  closeUnit(unit);
+}
+
+static void recordSample(Unit & unit) {
+  ReplyReader reply(unit.rx, unit.rxLen);
+  Slice key, value;
+  char head[96];
+
+  if (!reply.ok()) {
+    finishPoll(unit, false);
+    return;
+  }
+
+  append(head, snprintf(head, sizeof(head), "%llu\t%s",
+    (unsigned long long)realtimeMs(), unit.name));
+  while (reply.next(key, value)) {
+    /* acknowledgement of the "zone N" line */
+    if (key.len == 7 && memcmp(key.ptr, "success", 7) == 0)
+      continue;
+    append("\t", 1);
+    append(key.ptr, key.len);
+    append("=", 1);
+    if (value.len)
+      append(value.ptr, value.len);
+    else
+      append("1", 1);
+  }
+  append("\n", 1);
+
+  finishPoll(unit, true);
+}
+
+static void watch(Unit & unit, uint32_t events, int op) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = &unit;
+  epoll_ctl(epfd, op, unit.fd, &ev);
+}
+
+static void sendRequest(Unit & unit) {
+  while (unit.txSent < unit.txLen) {
+    ssize_t n = send(unit.fd, unit.tx + unit.txSent,
+      unit.txLen - unit.txSent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        return;
+      finishPoll(unit, false);
+      return;
+    }
+    unit.txSent += n;
+  }
+
+  unit.state = UNIT_RECEIVING;
+  watch(unit, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+}
+
+static void startPoll(Unit & unit, uint64_t now, int timeout) {
+  unit.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (unit.fd < 0) {
+    finishPoll(unit, false);
+    return;
+  }
+
+  int one = 1;
+  setsockopt(unit.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  unit.txSent = 0;
+  unit.rxLen = 0;
+  unit.deadline = now + timeout;
+
+  if (connect(unit.fd, (sockaddr *)&unit.addr, sizeof(unit.addr)) == 0) {
+    unit.state = UNIT_SENDING;
+    watch(unit, EPOLLOUT, EPOLL_CTL_ADD);
+    sendRequest(unit);
+  } else if (errno == EINPROGRESS) {
+    unit.state = UNIT_CONNECTING;
+    watch(unit, EPOLLOUT, EPOLL_CTL_ADD);
+  } else {
+    finishPoll(unit, false);
+  }
+}
+
+static void handleEvent(Unit & unit, uint32_t events) {
+  if (unit.state == UNIT_CONNECTING) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(unit.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error || (events & EPOLLERR)) {
+      finishPoll(unit, false);
+      return;
+    }
+    unit.state = UNIT_SENDING;
+  }
+
+  if (unit.state == UNIT_SENDING) {
+    sendRequest(unit);
+    return;
+  }
+
+  if (unit.state != UNIT_RECEIVING)
+    return;
+
+  for (;;) {
+    if (unit.rxLen == sizeof(unit.rx)) {
+      /* an incubator reply never gets this large */
+      finishPoll(unit, false);
+      return;
+    }
+    ssize_t n = recv(unit.fd, unit.rx + unit.rxLen,
+      sizeof(unit.rx) - unit.rxLen, 0);
+    if (n > 0) {
+      unit.rxLen += n;
+    } else if (n == 0) {
+      /* the incubator closes the connection after each reply */
+      recordSample(unit);
+      return;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN) {
+      return;
+    } else {
+      finishPoll(unit, false);
+      return;
+    }
+  }
+}
+
+static void onSignal(int) {
+  stopping = 1;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: gateway [-i interval_ms] [-t timeout_ms] [-n rounds] "
+    "[-o file] host[:port][/zone]...\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  int interval = DEFAULT_INTERVAL;
+  int timeout = DEFAULT_TIMEOUT;
+  long rounds = -1;
+  const char * path = "samples.tsv";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:t:n:o:")) != -1) {
+    switch (opt) {
+      case 'i': interval = atoi(optarg); break;
+      case 't': timeout = atoi(optarg); break;
+      case 'n': rounds = atol(optarg); break;
+      case 'o': path = optarg; break;
+      default: usage();
+    }
+  }
+  if (optind >= argc || interval <= 0 || timeout <= 0)
+    usage();
+
+  std::vector<Unit> units(argc - optind);
+  for (size_t i = 0; i < units.size(); i++) {
+    Unit & unit = units[i];
+    if (!parseUnit(argv[optind + i], unit)) {
+      fprintf(stderr, "gateway: bad unit '%s'\n", argv[optind + i]);
+      return 1;
+    }
+    unit.fd = -1;
+    unit.state = UNIT_IDLE;
+    unit.rounds = rounds;
+    unit.polls = unit.failures = 0;
+    buildRequest(unit);
+  }
+
+  outFd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (outFd < 0) {
+    perror(path);
+    return 1;
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return 1;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  /* spread the first polls over one interval */
+  uint64_t start = monotonicMs();
+  for (size_t i = 0; i < units.size(); i++)
+    units[i].nextPoll = start + (uint64_t)interval * i / units.size();
+
+  epoll_event events[MAX_EVENTS];
+
+  while (!stopping) {
+    uint64_t now = monotonicMs();
+    uint64_t wake = now + interval;
+    bool active = false;
+
+    for (Unit & unit : units) {
+      if (unit.state == UNIT_IDLE) {
+        if (unit.rounds == 0)
+          continue;
+        if (unit.nextPoll <= now) {
+          unit.nextPoll += interval;
+          if (unit.nextPoll <= now)
+            unit.nextPoll = now + interval;
+          startPoll(unit, now, timeout);
+        }
+      } else if (unit.deadline <= now) {
+        finishPoll(unit, false);
+      }
+
+      if (unit.state != UNIT_IDLE) {
+        active = true;
+        if (unit.deadline < wake)
+          wake = unit.deadline;
+      } else if (unit.rounds != 0) {
+        active = true;
+        if (unit.nextPoll < wake)
+          wake = unit.nextPoll;
+      }
+    }
+
+    if (!active)
+      break;
+
+    if (outLen)
+      flushOutput();
+
+    int n = epoll_wait(epfd, events, MAX_EVENTS,
+      wake > now ? (int)(wake - now) : 0);
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; i++)
+      handleEvent(*(Unit *)events[i].data.ptr, events[i].events);
+  }
+
+  flushOutput();
+  close(outFd);
+
+  unsigned long polls = 0, failures = 0;
+  for (Unit & unit : units) {
+    closeUnit(unit);
+    polls += unit.polls;
+    failures += unit.failures;
+    if (unit.failures)
+      fprintf(stderr, "%s: %lu of %lu polls failed\n",
+        unit.name, unit.failures, unit.polls);
+  }
+  fprintf(stderr, "gateway: %zu units, %lu polls, %lu failed\n",
+    units.size(), polls, failures);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include "protocol.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char * findCRLFCRLF(const char * p, const char * end) {
+  for (; p + 4 <= end; p++)
+    if (p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+      return p;
+  return nullptr;
+}
+
+/* value of the header "name: value" among the lines before end, or -1 */
+static long headerValue(const char * p, const char * end, const char * name) {
+  size_t n = strlen(name);
+
+  while (p < end) {
+    const char * eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    if ((size_t)(eol - p) > n && strncasecmp(p, name, n) == 0)
+      return strtol(p + n, nullptr, 10);
+    p = eol + 1;
+  }
+  return -1;
+}
+
+ReplyReader::ReplyReader(const char * data, size_t len)
+  : status(0), contentLength(-1), complete(false), cur(data), end(data + len)
+{
+  const char * body = findCRLFCRLF(data, end);
+  if (!body) {
+    cur = end;
+    return;
+  }
+
+  /* a reply cut short by the connection closing is not a sample */
+  contentLength = headerValue(data, body, "Content-Length:");
+  complete = contentLength < 0 || end - (body + 4) >= contentLength;
+
+  /* "HTTP/1.1 200 OK" */
+  const char * p = data;
+  while (p < body && *p != ' ')
+    p++;
+  while (p < body && *p == ' ')
+    p++;
+  while (p < body && *p >= '0' && *p <= '9')
+    status = status * 10 + (*p++ - '0');
+
+  cur = body + 4;
+}
+
+bool ReplyReader::next(Slice & key, Slice & value) {
+  while (cur < end) {
+    const char * line = cur;
+    const char * eol = (const char *)memchr(cur, '\n', end - cur);
+    if (!eol)
+      eol = end;
+    cur = (eol < end) ? eol + 1 : end;
+
+    const char * stop = eol;
+    if (stop > line && stop[-1] == '\r')
+      stop--;
+    if (stop == line)
+      continue;
+
+    const char * sp = (const char *)memchr(line, ' ', stop - line);
+    key.ptr = line;
+    key.len = (sp ? sp : stop) - line;
+    value.ptr = sp ? sp + 1 : stop;
+    value.len = stop - value.ptr;
+    return true;
+  }
+  return false;
+}
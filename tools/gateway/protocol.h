@@ -0,0 +1,38 @@
+#ifndef GATEWAY_PROTOCOL_H
+#define GATEWAY_PROTOCOL_H
+
+#include <stddef.h>
+
+/*
+ * Zero-copy reader of the incubator's /control reply. A reply is an
+ * HTTP response whose body is a sequence of "key value\r\n" lines
+ * (see processCommand() in src/control.cpp). Fields point into the
+ * receive buffer; nothing is copied.
+ */
+
+struct Slice {
+  const char * ptr;
+  size_t len;
+};
+
+class ReplyReader {
+  public:
+    ReplyReader(const char * data, size_t len);
+
+    /* false if the header or status line is missing or not 200, or
+       if the body is shorter than its Content-Length */
+    bool ok() const { return status == 200 && complete; }
+
+    /* next "key value" line of the body; value may be empty */
+    bool next(Slice & key, Slice & value);
+
+    int status;
+    long contentLength;   /* -1 without the header */
+    bool complete;
+
+  private:
+    const char * cur;
+    const char * end;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#!/bin/bash
+#
+# Runs the gateway against fake incubators on the loopback interface
+# and checks the time-series file it writes:
+#  - every unit gets one sample per round, slow ones included,
+#  - every sample line parses (unix ms, unit, key=value fields),
+#  - a unit killed in the middle of a run is reported as failing
+#    while the others keep their full sample count,
+#  - a reply cut short in the body is a failed poll, not a sample.
+#
+# Usage: test.sh [port]
+
+PORT=${1:-21000}
+UNITS=5
+ROUNDS=5
+DIR=$(mktemp -d)
+FAKES=
+
+cleanup() {
+  [ -n "$FAKES" ] && kill $FAKES 2>/dev/null
+  wait 2>/dev/null
+  rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+# start_fake port count [options]; waits until the last port accepts
+start_fake() {
+  port=$1
+  count=$2
+  shift 2
+  ./fake_incubator "$@" "$port" "$count" &
+  FAKE=$!
+  FAKES="$FAKES $FAKE"
+  last=$((port + count - 1))
+  for i in 1 2 3 4 5 6 7 8 9 10; do
+    (exec 3<>/dev/tcp/127.0.0.1/$last) 2>/dev/null && return 0
+    sleep 0.1
+  done
+  fail "fake_incubator on port $port did not start"
+}
+
+units() {
+  i=0
+  while [ $i -lt "$2" ]; do
+    printf '127.0.0.1:%d ' $(($1 + i))
+    i=$((i + 1))
+  done
+}
+
+# check_samples file unit expected
+check_samples() {
+  n=$(awk -F '\t' -v u="$2" '$2 == u' "$1" | wc -l)
+  [ "$n" -eq "$3" ] || fail "$2: $n samples, expected $3"
+}
+
+# every line: unix ms, unit, then key=value with the fields polled
+check_lines() {
+  awk -F '\t' '
+    $1 !~ /^[0-9]+$/ || NF < 4 { bad++; next }
+    {
+      for (i = 3; i <= NF; i++)
+        if ($i !~ /^[a-z_]+=[^=]*$/) { bad++; next }
+      if ($0 !~ /\tcurrent_temp=/ || $0 !~ /\tneeded_temp=/) bad++
+    }
+    END { exit bad > 0 }' "$1" || fail "$1: malformed sample lines"
+}
+
+# one slow unit answers late, but within the timeout
+start_fake $PORT $UNITS -d 300 -s 3
+./gateway -i 200 -t 1000 -n $ROUNDS -o "$DIR/all.tsv" $(units $PORT $UNITS) \
+  2>"$DIR/all.err" || fail "gateway failed: $(cat "$DIR/all.err")"
+check_lines "$DIR/all.tsv"
+i=0
+while [ $i -lt $UNITS ]; do
+  check_samples "$DIR/all.tsv" "127.0.0.1:$((PORT + i))" $ROUNDS
+  i=$((i + 1))
+done
+echo "ok: $UNITS units, $ROUNDS rounds"
+
+# a unit that goes away during the run
+VICTIM_PORT=$((PORT + UNITS))
+start_fake $VICTIM_PORT 1
+VICTIM=$FAKE
+
+./gateway -i 200 -t 500 -n 10 -o "$DIR/kill.tsv" \
+  $(units $PORT $UNITS) 127.0.0.1:$VICTIM_PORT 2>"$DIR/kill.err" &
+GATEWAY=$!
+sleep 1
+kill $VICTIM
+wait $VICTIM 2>/dev/null
+wait $GATEWAY && fail "gateway did not report the killed unit"
+
+check_lines "$DIR/kill.tsv"
+i=0
+while [ $i -lt $UNITS ]; do
+  check_samples "$DIR/kill.tsv" "127.0.0.1:$((PORT + i))" 10
+  i=$((i + 1))
+done
+n=$(awk -F '\t' -v u="127.0.0.1:$VICTIM_PORT" '$2 == u' "$DIR/kill.tsv" | wc -l)
+[ "$n" -gt 0 ] && [ "$n" -lt 10 ] || fail "killed unit: $n samples"
+grep -q "^127.0.0.1:$VICTIM_PORT: [0-9]* of 10 polls failed" "$DIR/kill.err" \
+  || fail "killed unit not reported: $(cat "$DIR/kill.err")"
+echo "ok: killed unit failed after $n samples, the others kept polling"
+
+# a unit that closes every connection half way through the body
+CUT_PORT=$((PORT + UNITS + 1))
+start_fake $CUT_PORT 1 -c 1
+
+./gateway -i 200 -t 500 -n 3 -o "$DIR/cut.tsv" \
+  127.0.0.1:$PORT 127.0.0.1:$CUT_PORT 2>"$DIR/cut.err" \
+  && fail "gateway did not report the cut replies"
+check_samples "$DIR/cut.tsv" "127.0.0.1:$PORT" 3
+check_samples "$DIR/cut.tsv" "127.0.0.1:$CUT_PORT" 0
+grep -q "^127.0.0.1:$CUT_PORT: 3 of 3 polls failed" "$DIR/cut.err" \
+  || fail "cut replies not reported: $(cat "$DIR/cut.err")"
+echo "ok: replies cut short in the body are failed polls"
@@ -0,0 +1,100 @@
+/*
+ * Runs the wetter controller (src/humidity.cpp) against a simulated
+ * chamber and reports how well it holds the humidity. The chamber
+ * rises by GAIN % per second of wetting, spread over a few seconds as
+ * the vapour mixes, and dries out towards the room humidity. The DHT22
+ * is a lagged sensor read every DHT_PERIOD with 0.1 % resolution.
+ * Exits with 1 when the humidity leaves the band after the first hour
+ * or the learned gain is far off, so it doubles as a regression test.
+ *
+ * Usage: humidsim [-g gain] [-n target] [-r room] [-H hours] [-v]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "humidity.h"
+
+#define STEP 100          /* ms */
+#define MIX_TAU 10.0      /* s, spreading of the vapour */
+#define DRY_TAU 3600.0    /* s, drying towards the room */
+#define SENSOR_TAU 30.0   /* s, DHT22 response */
+#define WARMUP 3600       /* s before the band is checked */
+
+static void usage() {
+  fprintf(stderr,
+    "usage: humidsim [-g gain] [-n target] [-r room] [-H hours] [-v]\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  double gain = 8, target = 78, room = 40, hours = 12;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "g:n:r:H:v")) != -1) {
+    switch (opt) {
+      case 'g': gain = atof(optarg); break;
+      case 'n': target = atof(optarg); break;
+      case 'r': room = atof(optarg); break;
+      case 'H': hours = atof(optarg); break;
+      case 'v': verbose = true; break;
+      default: usage();
+    }
+  }
+  if (optind != argc || hours * 3600 <= WARMUP)
+    usage();
+
+  HumidityController controller;
+  double humidity = room, mixing = 0, sensor = room;
+  float reading = NAN;
+  double low = 100, high = 0, sum = 0;
+  uint32_t samples = 0, pulsesAtWarmup = 0;
+  bool wetting = false;
+
+  controller.begin(0);
+  uint32_t end = (uint32_t)(hours * 3600 * 1000);
+
+  for (uint32_t now = 0; now < end; now += STEP) {
+    double dt = STEP / 1000.0;
+
+    /* vapour from the wetter reaches the air over MIX_TAU */
+    if (wetting)
+      mixing += gain * dt;
+    double mixed = mixing * dt / MIX_TAU;
+    mixing -= mixed;
+    humidity += mixed - (humidity - room) * dt / DRY_TAU;
+    sensor += (humidity - sensor) * dt / SENSOR_TAU;
+
+    if (now % DHT_PERIOD == 0)
+      reading = roundf(sensor * 10) / 10;
+    wetting = controller.update(reading, target, now);
+
+    if (now / 1000 == WARMUP && now % 1000 == 0)
+      pulsesAtWarmup = controller.pulses;
+    if (now / 1000 >= WARMUP) {
+      low = fmin(low, humidity);
+      high = fmax(high, humidity);
+      sum += humidity;
+      samples++;
+    }
+    if (verbose && now % 60000 == 0)
+      printf("%6u s  humidity %5.2f  reading %5.1f  gain %5.2f  loss %7.4f\n",
+        now / 1000, humidity, reading, controller.gain, controller.lossRate);
+  }
+
+  double mean = sum / samples;
+  double perHour = (controller.pulses - pulsesAtWarmup) / (hours - WARMUP / 3600.0);
+  printf("target %.1f %%: mean %.2f, range %.2f..%.2f, %.1f pulses/h, "
+    "gain %.2f learned %.2f\n",
+    target, mean, low, high, perHour, gain, controller.gain);
+
+  bool ok = high <= target + HUMIDITY_DEADBAND
+    && low >= target - 2 * HUMIDITY_DEADBAND
+    && fabs(controller.gain - gain) <= 0.3 * gain;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/*
+ * Records a trace with the firmware recorder (src/trace.cpp,
+ * src/relays.cpp, src/flashring.cpp) from a simulated zone, for the
+ * fixtures in testdata/. The chamber is of first order with a dead
+ * time; the DS18B20 and DHT22 readings carry noise and the DHT22 now
+ * and then fails a humidity reading. The climate controller runs at
+ * the rates of the firmware: the heater every SAFETY_PERIOD, the
+ * wetter on every loop pass. The noise comes from a fixed generator,
+ * so a run is reproducible.
+ *
+ * The chamber starts at 36 degrees, or at -T, and the setpoints rise
+ * half way through the pages written; the preview one chamber dead
+ * time earlier, as a program's look-ahead does. With -d all probes are
+ * silent for a while, which the heater must ride out switched off.
+ * With -k only the pages of the last minutes are written, as the ring
+ * holds them after it wrapped on a long run.
+ *
+ * Usage: record [-m minutes] [-k minutes] [-d start_s:length_s]
+ *               [-T celsius] trace
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "climate.h"
+#include "constants.h"
+#include "fusion.h"
+#include "relays.h"
+#include "trace.h"
+#include "zone.h"
+
+#define FLASH_SIZE (16UL * 1024 * 1024)
+
+#define PLANT_STEP 10         /* ms */
+#define PLANT_GAIN 25.0       /* degrees above the room at full heat */
+#define PLANT_TAU 1800.0      /* s */
+#define PLANT_DELAY 60000     /* ms */
+#define ROOM 22.0
+#define DS_PERIOD 750
+
+static uint32_t nowMs = 1000;
+static std::vector<uint8_t> flash(FLASH_SIZE, 0xFF);
+static uint32_t noise = 1;
+
+unsigned long millis() { return nowMs; }
+unsigned long micros() { return nowMs * 1000; }
+void pinMode(int, int) {}
+void digitalWrite(int, int) {}
+
+int mbed::FlashIAP::init() { return 0; }
+uint32_t mbed::FlashIAP::get_flash_start() const { return 0; }
+uint32_t mbed::FlashIAP::get_flash_size() const { return FLASH_SIZE; }
+
+int mbed::FlashIAP::read(void * buffer, uint32_t address, uint32_t size) {
+  memcpy(buffer, &flash[address], size);
+  return 0;
+}
+
+int mbed::FlashIAP::program(const void * buffer, uint32_t address, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++)
+    flash[address + i] &= ((const uint8_t *)buffer)[i];
+  return 0;
+}
+
+int mbed::FlashIAP::erase(uint32_t address, uint32_t size) {
+  memset(&flash[address], 0xFF, size);
+  return 0;
+}
+
+Zone zones[N_ZONES];
+
+const char * Zone::commitConfig(ZoneConfig config) {
+  configs[0] = config;
+  activeConfig = 0;
+  traceConfig(number, config.neededTemperature, config.neededHumidity);
+  return NULL;
+}
+
+/* 0 <= draw(n) < n, from a fixed xorshift sequence */
+static uint32_t draw(uint32_t n) {
+  noise ^= noise << 13;
+  noise ^= noise >> 17;
+  noise ^= noise << 5;
+  return noise % n;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: record [-m minutes] [-k minutes] [-d start_s:length_s] "
+    "[-T celsius] trace\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  uint32_t minutes = 45, keep = 0;
+  uint32_t dropStart = 0, dropLength = 0;
+  double temperature = 36.0, humidity = 40;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:k:d:T:")) != -1) {
+    switch (opt) {
+      case 'm': minutes = atol(optarg); break;
+      case 'k': keep = atol(optarg); break;
+      case 'T': temperature = atof(optarg); break;
+      case 'd':
+        if (sscanf(optarg, "%u:%u", &dropStart, &dropLength) != 2)
+          usage();
+        break;
+      default: usage();
+    }
+  }
+  if (optind != argc - 1 || minutes == 0 || keep > minutes)
+    usage();
+
+  Zone & zone = zones[0];
+  ClimateController & climate = zone.climate;
+  SensorFusion fusion;
+  uint32_t end = nowMs + minutes * 60000;
+  uint32_t keepFrom = keep ? end - keep * 60000 : 0;
+  uint32_t raiseAt = end - (keep ? keep : minutes) * 30000;
+  uint32_t firstSeq = 0;
+
+  zone.number = 0;
+  zone.nThermoSensors = 1;
+  traceBegin();
+  climate.begin(nowMs);
+
+  ZoneConfig config = {37.5, 55, 12, 0};
+  zone.commitConfig(config);
+  zone.previewTemperature = config.neededTemperature;
+  tracePreview(0, zone.previewTemperature);
+
+  relayAttach(zonePins[0].heater, 0, RELAY_HEATER);
+  relayAttach(zonePins[0].wetter, 0, RELAY_WETTER);
+  relayAttach(zonePins[0].ring, 0, RELAY_RING);
+  relayAttach(zonePins[0].ventil, 0, RELAY_VENTIL);
+
+  fusion.begin(2);
+  fusion.setWeight(1, FUSION_DHT_WEIGHT);
+
+  uint32_t dsTime = 0, dhtTime = 0, safetyTime = nowMs, plantTime = nowMs;
+  std::vector<bool> delay(PLANT_DELAY / PLANT_STEP, false);
+  size_t delayPos = 0;
+  bool previewed = false, raised = false;
+
+  while (nowMs < end) {
+    /* a loop() pass */
+    nowMs += 7 + draw(5);
+
+    uint32_t uptime = (nowMs - 1000) / 1000;
+    if (uptime >= dropStart && uptime < dropStart + dropLength)
+      dsTime = dhtTime = nowMs;
+
+    if (nowMs - dhtTime >= DHT_PERIOD) {
+      dhtTime = nowMs;
+      float reading = humidity + draw(10) / 10.0;
+      if (draw(50) == 0)
+        reading = NAN;
+      zone.currentHumidity = reading;
+      traceHumidity(0, reading);
+
+      float dhtTemperature = temperature + 0.3;
+      traceProbe(0, 1, dhtTemperature);
+      fusion.sample(1, dhtTemperature, nowMs);
+    }
+    if (nowMs - dsTime >= DS_PERIOD) {
+      dsTime = nowMs;
+      float reading = temperature + ((int)draw(7) - 3) / 100.0;
+      traceProbe(0, 0, reading);
+      fusion.sample(0, reading, nowMs);
+    }
+    fusion.update(nowMs);
+    float fused = fusion.valid ? fusion.value : TEMP_ERROR;
+
+    climate.updateHumidity(zone.currentHumidity,
+                           zone.config().neededHumidity, nowMs);
+    relayWrite(zonePins[0].wetter, climate.wetter ? ON : OFF);
+
+    /* the safety timer, on its own exact period */
+    while (nowMs - safetyTime >= SAFETY_PERIOD) {
+      safetyTime += SAFETY_PERIOD;
+      climate.updateThermal(fused, zone.config().neededTemperature,
+                            zone.previewTemperature);
+      traceHeater(0, climate.heating);
+      relayWrite(zonePins[0].heater, climate.heater ? ON : OFF);
+      relayWrite(zonePins[0].ring, climate.ring ? ON : OFF);
+      relayWrite(zonePins[0].ventil, climate.ventil ? ON : OFF);
+    }
+
+    while (nowMs - plantTime >= PLANT_STEP) {
+      plantTime += PLANT_STEP;
+      bool heat = delay[delayPos];
+      delay[delayPos] = climate.heater;
+      delayPos = (delayPos + 1) % delay.size();
+      temperature += PLANT_STEP / 1000.0
+        * (PLANT_GAIN * heat - (temperature - ROOM)) / PLANT_TAU;
+    }
+    humidity += climate.wetter ? 0.01 : -0.0001;
+
+    if (!previewed && nowMs >= raiseAt - PLANT_DELAY) {
+      previewed = true;
+      zone.previewTemperature = 37.8;
+      tracePreview(0, zone.previewTemperature);
+    }
+    if (!raised && nowMs >= raiseAt) {
+      raised = true;
+      config.neededTemperature = 37.8;
+      config.neededHumidity = 60;
+      zone.commitConfig(config);
+    }
+
+    if (keep && !firstSeq && nowMs >= keepFrom)
+      firstSeq = traceRing.next();
+    FlashRing::newPass();
+    traceService();
+  }
+  traceFlush();
+
+  FILE * out = fopen(argv[optind], "wb");
+  if (!out) {
+    perror(argv[optind]);
+    return 1;
+  }
+  const uint8_t * region = &flash[FLASH_SIZE - TRACE_FLASH_TOP];
+  uint32_t pages = 0;
+  for (uint32_t offset = 0; offset < TRACE_FLASH_SIZE; offset += FLASH_PAGE_SIZE) {
+    const uint8_t * page = region + offset;
+    FlashPageHeader header;
+    memcpy(&header, page, sizeof(header));
+    if (header.magic != TRACE_MAGIC || (int32_t)(header.seq - firstSeq) < 0)
+      continue;
+    fwrite(page, 1, FLASH_PAGE_SIZE, out);
+    pages++;
+  }
+  fclose(out);
+
+  printf("%u pages, %u records, %u dropped, heater mode %d, "
+    "model gain %.2f tau %.0f s\n",
+    pages, traceStats.records, traceStats.dropped, climate.heating.mode,
+    climate.heating.model.gain, climate.heating.model.tau);
+  return 0;
+}
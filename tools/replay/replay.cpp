@@ -0,0 +1,587 @@
+/*
+ * Replays a trace recorded by the firmware (src/trace.cpp) through the
+ * same sensor fusion and climate code (src/fusion.cpp, src/climate.cpp,
+ * src/thermal.cpp) and compares its relay decisions with the recorded
+ * relay outputs. Exits with 1 when they differ, or when the replayed
+ * heater is on while the fusion has no valid temperature, so a trace
+ * doubles as a regression test of a controller change.
+ *
+ * The input is a sequence of 256-byte flash pages in any order, as
+ * written by tracefetch or read out of the flash region directly.
+ *
+ * A segment that starts at a boot replays the heater from its start.
+ * One that starts in the middle of a run, as the oldest pages of a
+ * wrapped ring do, continues the heater from the first complete state
+ * the firmware wrote (TRACE_HEATER) and compares it from there on.
+ *
+ * With -p the replay also fails unless at least that many heater
+ * switchings were compared while the heater ran in PI mode, so that a
+ * fixture keeps exercising the model-based control.
+ *
+ * Usage: replay [-t tolerance_ms] [-w warmup_ms] [-s step_ms] [-p n] [-v]
+ *               trace
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "climate.h"
+#include "constants.h"
+#include "fusion.h"
+#include "tracefmt.h"
+
+#define PAYLOAD (FLASH_PAGE_SIZE - 8)
+
+struct Page {
+  uint32_t seq;
+  uint8_t data[PAYLOAD];
+};
+
+struct Event {
+  uint32_t time;
+  uint8_t type;
+  uint8_t zone;
+  uint8_t channel;
+  float value;
+  float value2;
+  uint32_t words[TRACE_HEATER_CHUNK_WORDS];
+};
+
+/* a complete heater state and the uptime it was taken at */
+struct HeaterState {
+  uint32_t time;
+  uint8_t zone;
+  uint32_t words[THERMAL_STATE_WORDS];
+};
+
+struct Segment {
+  std::vector<Event> events;
+};
+
+struct Transition {
+  uint32_t time;
+  uint8_t zone;
+  uint8_t kind;
+  bool on;
+  bool matched;
+};
+
+struct ZoneSim {
+  bool known;
+  bool fresh;
+  int nProbes;
+  SensorFusion fusion;
+  ClimateController climate;
+  float neededTemperature;
+  float previewTemperature;
+  float neededHumidity;
+  float humidity;
+  float temperature;
+  uint32_t lastThermal;
+  /* heater switchings count from heaterFrom on */
+  bool heaterKnown;
+  uint32_t heaterFrom;
+  int piSwitchings;
+  int unsafe;
+  bool recorded[N_RELAY_KINDS];
+  uint32_t recordedOn[N_RELAY_KINDS];
+  uint32_t replayedOn[N_RELAY_KINDS];
+  uint32_t recordedSince[N_RELAY_KINDS];
+  uint32_t replayedSince[N_RELAY_KINDS];
+};
+
+static const char * KIND_NAMES[N_RELAY_KINDS] = {
+  "motor_p", "motor_m", "wetter", "cooler", "heater", "ring", "ventil"
+};
+
+/* the relays the climate controller decides on */
+static const int CLIMATE_KINDS[] = {
+  RELAY_HEATER, RELAY_RING, RELAY_VENTIL, RELAY_WETTER
+};
+
+static uint32_t tolerance = 500;
+static uint32_t warmup = HUMID_SETTLE_TIME;
+static uint32_t step = 10;
+static bool verbose = false;
+static int minPi = 0;
+static int piSwitchings = 0;
+
+static uint32_t le32(const uint8_t * p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::vector<Page> readPages(const char * path) {
+  std::vector<Page> pages;
+  uint8_t raw[FLASH_PAGE_SIZE];
+
+  FILE * f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    exit(2);
+  }
+  while (fread(raw, 1, sizeof(raw), f) == sizeof(raw)) {
+    if (le32(raw) != TRACE_MAGIC)
+      continue;
+    Page page;
+    page.seq = le32(raw + 4);
+    memcpy(page.data, raw + 8, PAYLOAD);
+    pages.push_back(page);
+  }
+  fclose(f);
+
+  std::sort(pages.begin(), pages.end(),
+    [](const Page & a, const Page & b) { return (int32_t)(a.seq - b.seq) < 0; });
+  return pages;
+}
+
+/* appends the records of one page; false if it is malformed */
+static bool decodePage(const Page & page, std::vector<Event> & out) {
+  const uint8_t * p = page.data;
+  const uint8_t * end = page.data + PAYLOAD;
+  uint32_t lastProbe[TRACE_MAX_ZONES][FUSION_MAX_PROBES] = {};
+  uint32_t lastHumidity[TRACE_MAX_ZONES] = {};
+  uint32_t time = 0;
+
+  while (p < end && *p != 0xFF) {
+    Event e = Event();
+    uint32_t dt, u, v;
+    int32_t s;
+
+    e.type = *p >> 4;
+    e.zone = *p++ & 0x0F;
+    if (!traceGetVarint(&p, end, &dt))
+      return false;
+    time += dt;
+
+    switch (e.type) {
+      case TRACE_SYNC:
+        if (!traceGetVarint(&p, end, &time))
+          return false;
+        break;
+      case TRACE_ZONE:
+      case TRACE_STATE:
+      case TRACE_RELAY:
+      case TRACE_TUNE:
+      case TRACE_BUTTON:
+      case TRACE_REED:
+        if (p >= end)
+          return false;
+        e.channel = *p++;
+        break;
+      case TRACE_CONFIG:
+      case TRACE_LEARNED:
+        if (!traceGetVarint(&p, end, &u) || !traceGetVarint(&p, end, &v))
+          return false;
+        e.value = traceBitsFloat(u);
+        e.value2 = traceBitsFloat(v);
+        break;
+      case TRACE_PREVIEW:
+        if (!traceGetVarint(&p, end, &u))
+          return false;
+        e.value = traceBitsFloat(u);
+        break;
+      case TRACE_HEATER:
+        if (p >= end)
+          return false;
+        e.channel = *p++;
+        if (e.channel == 0) {
+          if (!traceGetVarint(&p, end, &e.words[0]) || p >= end)
+            return false;
+          e.words[1] = *p++;
+        } else {
+          if (end - p < 4 * TRACE_HEATER_CHUNK_WORDS)
+            return false;
+          for (int i = 0; i < TRACE_HEATER_CHUNK_WORDS; i++, p += 4)
+            e.words[i] = traceGetWord(p);
+        }
+        break;
+      case TRACE_PROBE:
+        if (p >= end)
+          return false;
+        e.channel = *p++;
+        if (e.channel >= FUSION_MAX_PROBES || !traceGetSigned(&p, end, &s))
+          return false;
+        lastProbe[e.zone][e.channel] += s;
+        e.value = traceBitsFloat(lastProbe[e.zone][e.channel]);
+        break;
+      case TRACE_HUMID:
+        if (!traceGetSigned(&p, end, &s))
+          return false;
+        lastHumidity[e.zone] += s;
+        e.value = traceBitsFloat(lastHumidity[e.zone]);
+        break;
+      default:
+        return false;
+    }
+
+    e.time = time;
+    out.push_back(e);
+  }
+  return true;
+}
+
+/* splits the trace at resets (uptime going back) and at lost pages */
+static std::vector<Segment> segments(const std::vector<Page> & pages) {
+  std::vector<Segment> result;
+  uint32_t lastSeq = 0;
+  uint32_t lastTime = 0;
+
+  for (const Page & page : pages) {
+    std::vector<Event> events;
+    if (!decodePage(page, events)) {
+      fprintf(stderr, "page %u: malformed, skipped\n", page.seq);
+      continue;
+    }
+    if (events.empty())
+      continue;
+
+    if (result.empty() || page.seq != lastSeq + 1 || events[0].time < lastTime)
+      result.push_back(Segment());
+    Segment & seg = result.back();
+    seg.events.insert(seg.events.end(), events.begin(), events.end());
+
+    lastSeq = page.seq;
+    lastTime = events.back().time;
+  }
+  return result;
+}
+
+/* the heater states whose chunks all made it into the segment */
+static std::vector<HeaterState> heaterStates(const Segment & seg) {
+  std::vector<HeaterState> states;
+  HeaterState partial[TRACE_MAX_ZONES];
+  int nextChunk[TRACE_MAX_ZONES];
+  int chunks = 1 + (THERMAL_STATE_WORDS + TRACE_HEATER_CHUNK_WORDS - 1)
+    / TRACE_HEATER_CHUNK_WORDS;
+
+  for (int i = 0; i < TRACE_MAX_ZONES; i++)
+    nextChunk[i] = -1;
+
+  for (const Event & e : seg.events) {
+    if (e.type != TRACE_HEATER)
+      continue;
+    HeaterState & s = partial[e.zone];
+    if (e.channel == 0) {
+      /* a trace of another firmware */
+      if (e.words[1] != THERMAL_STATE_WORDS) {
+        nextChunk[e.zone] = -1;
+        continue;
+      }
+      s.time = e.time - e.words[0];
+      s.zone = e.zone;
+      nextChunk[e.zone] = 1;
+      continue;
+    }
+    if (e.channel != nextChunk[e.zone]) {
+      nextChunk[e.zone] = -1;
+      continue;
+    }
+    for (int i = 0; i < TRACE_HEATER_CHUNK_WORDS; i++) {
+      int word = (e.channel - 1) * TRACE_HEATER_CHUNK_WORDS + i;
+      if (word < THERMAL_STATE_WORDS)
+        s.words[word] = e.words[i];
+    }
+    if (++nextChunk[e.zone] == chunks) {
+      states.push_back(s);
+      nextChunk[e.zone] = -1;
+    }
+  }
+  return states;
+}
+
+/* continues the heater of a zone that started mid-run from the state
+   the firmware wrote */
+static void seedHeater(ZoneSim & z, const HeaterState & s) {
+  if (!z.known || z.heaterKnown)
+    return;
+
+  bool was = z.climate.heater;
+  z.climate.heating.state((uint32_t *)s.words, true);
+  z.climate.heater = z.climate.heating.on;
+  if (was && !z.climate.heater)
+    z.replayedOn[RELAY_HEATER] += s.time - z.replayedSince[RELAY_HEATER];
+  if (!was && z.climate.heater)
+    z.replayedSince[RELAY_HEATER] = s.time;
+
+  z.lastThermal = s.time;
+  z.heaterKnown = true;
+  z.heaterFrom = s.time;
+}
+
+/* whether a switching at time takes part in the comparison */
+static bool compared(const ZoneSim & z, int kind, uint32_t time, uint32_t start) {
+  if (time - start < warmup)
+    return false;
+  return kind != RELAY_HEATER || (z.heaterKnown && time >= z.heaterFrom);
+}
+
+static void setRecorded(ZoneSim & z, int kind, bool on, uint32_t time) {
+  if (z.recorded[kind] && !on)
+    z.recordedOn[kind] += time - z.recordedSince[kind];
+  if (!z.recorded[kind] && on)
+    z.recordedSince[kind] = time;
+  z.recorded[kind] = on;
+}
+
+static bool replayedState(const ZoneSim & z, int kind) {
+  switch (kind) {
+    case RELAY_HEATER: return z.climate.heater;
+    case RELAY_RING: return z.climate.ring;
+    case RELAY_VENTIL: return z.climate.ventil;
+    case RELAY_WETTER: return z.climate.wetter;
+  }
+  return false;
+}
+
+static void apply(ZoneSim * zones, const Event & e, uint32_t start,
+                  std::vector<Transition> & recorded)
+{
+  ZoneSim & z = zones[e.zone];
+
+  switch (e.type) {
+    case TRACE_ZONE:
+      if (!z.known || z.nProbes != e.channel) {
+        z.known = true;
+        z.fresh = true;
+        z.nProbes = e.channel;
+        z.fusion.begin(z.nProbes + 1);
+        z.fusion.setWeight(z.nProbes, FUSION_DHT_WEIGHT);
+        z.climate.begin(e.time);
+        z.humidity = NAN;
+        z.previewTemperature = NAN;
+      }
+      break;
+    case TRACE_CONFIG:
+      z.neededTemperature = e.value;
+      z.neededHumidity = e.value2;
+      break;
+    case TRACE_PREVIEW:
+      z.previewTemperature = e.value;
+      break;
+    case TRACE_TUNE:
+      z.climate.heating.requestAutotune(e.channel);
+      break;
+    case TRACE_STATE:
+      for (int kind = 0; kind < N_RELAY_KINDS; kind++)
+        setRecorded(z, kind, (e.channel >> kind) & 1, e.time);
+      /* start the hysteresis where the recording was */
+      if (z.fresh) {
+        z.climate.heater = z.recorded[RELAY_HEATER];
+        z.climate.heating.on = z.recorded[RELAY_HEATER];
+        z.climate.ventil = z.recorded[RELAY_VENTIL];
+      }
+      break;
+    case TRACE_LEARNED:
+      /* zones that were not set up yet when the keyframe was written */
+      if (z.fresh && e.value > 0) {
+        z.climate.humidifier.gain = e.value;
+        z.climate.humidifier.lossRate = e.value2;
+        z.fresh = false;
+      }
+      break;
+    case TRACE_PROBE:
+      if (z.known)
+        z.fusion.sample(e.channel, e.value, e.time);
+      break;
+    case TRACE_HUMID:
+      z.humidity = e.value;
+      break;
+    case TRACE_RELAY: {
+      int kind = e.channel >> 1;
+      bool on = e.channel & 1;
+      if (kind >= N_RELAY_KINDS)
+        break;
+      /* relays.cpp records switchings only; the keyframe of a page
+         started by this record may already show the new state */
+      if (compared(z, kind, e.time, start))
+        recorded.push_back({e.time, e.zone, (uint8_t)kind, on, false});
+      setRecorded(z, kind, on, e.time);
+      break;
+    }
+    case TRACE_BUTTON:
+    case TRACE_REED:
+      if (verbose)
+        printf("%10u  zone %d %s %d -> %d\n", e.time, e.zone,
+          e.type == TRACE_BUTTON ? "button" : "reed",
+          e.channel >> 1, e.channel & 1);
+      break;
+  }
+}
+
+static void stepZone(ZoneSim & z, int zone, uint32_t now, uint32_t start,
+                     std::vector<Transition> & replayed)
+{
+  if (!z.known)
+    return;
+
+  bool before[N_RELAY_KINDS];
+  for (int kind : CLIMATE_KINDS)
+    before[kind] = replayedState(z, kind);
+
+  /* loop() publishes the temperature, the safety timer acts on it */
+  z.fusion.update(now);
+  z.temperature = z.fusion.valid ? z.fusion.value : TEMP_ERROR;
+  if (now - z.lastThermal >= SAFETY_PERIOD) {
+    /* traces from before the preview was recorded */
+    float preview = isnan(z.previewTemperature)
+      ? z.neededTemperature : z.previewTemperature;
+    z.climate.updateThermal(z.temperature, z.neededTemperature, preview);
+    z.lastThermal = now;
+    if (!z.fusion.valid && z.climate.heater) {
+      z.unsafe++;
+      printf("%10u  zone %d heater  on   without a valid temperature\n",
+        now, zone);
+    }
+  }
+  z.climate.updateHumidity(z.humidity, z.neededHumidity, now);
+
+  for (int kind : CLIMATE_KINDS) {
+    bool on = replayedState(z, kind);
+    if (on == before[kind])
+      continue;
+    if (before[kind])
+      z.replayedOn[kind] += now - z.replayedSince[kind];
+    else
+      z.replayedSince[kind] = now;
+    if (!compared(z, kind, now, start))
+      continue;
+    replayed.push_back({now, (uint8_t)zone, (uint8_t)kind, on, false});
+    if (kind == RELAY_HEATER && z.climate.heating.mode == HEATER_PI)
+      z.piSwitchings++;
+  }
+}
+
+/* pairs recorded and replayed switchings within the tolerance */
+static int compare(std::vector<Transition> & recorded,
+                   std::vector<Transition> & replayed)
+{
+  int mismatches = 0;
+
+  for (Transition & r : recorded) {
+    for (Transition & p : replayed) {
+      if (p.matched || p.zone != r.zone || p.kind != r.kind || p.on != r.on)
+        continue;
+      uint32_t d = (p.time > r.time) ? p.time - r.time : r.time - p.time;
+      if (d <= tolerance) {
+        p.matched = r.matched = true;
+        break;
+      }
+    }
+  }
+
+  for (const Transition & r : recorded) {
+    if (r.matched)
+      continue;
+    mismatches++;
+    printf("%10u  zone %d %-7s %s  recorded only\n",
+      r.time, r.zone, KIND_NAMES[r.kind], r.on ? "on " : "off");
+  }
+  for (const Transition & p : replayed) {
+    if (p.matched)
+      continue;
+    mismatches++;
+    printf("%10u  zone %d %-7s %s  replayed only\n",
+      p.time, p.zone, KIND_NAMES[p.kind], p.on ? "on " : "off");
+  }
+  return mismatches;
+}
+
+static int replay(const Segment & seg, int index) {
+  static ZoneSim zones[TRACE_MAX_ZONES];
+  std::vector<Transition> recorded, replayed;
+
+  uint32_t start = seg.events.front().time;
+  uint32_t end = seg.events.back().time;
+  std::vector<HeaterState> states = heaterStates(seg);
+  size_t next = 0, nextState = 0;
+
+  /* before the first window the heater state is the one of begin() */
+  bool boot = start < THERMAL_WINDOW;
+  for (ZoneSim & z : zones) {
+    z = ZoneSim();
+    z.heaterKnown = boot;
+    z.heaterFrom = start;
+  }
+
+  for (uint32_t now = start; ; now += step) {
+    while (next < seg.events.size() && seg.events[next].time <= now)
+      apply(zones, seg.events[next++], start, recorded);
+    for (; nextState < states.size() && states[nextState].time <= now; nextState++)
+      seedHeater(zones[states[nextState].zone], states[nextState]);
+    for (int i = 0; i < TRACE_MAX_ZONES; i++)
+      stepZone(zones[i], i, now, start, replayed);
+    if (now >= end)
+      break;
+  }
+
+  int mismatches = compare(recorded, replayed);
+  int pi = 0;
+  for (const ZoneSim & z : zones) {
+    mismatches += z.unsafe;
+    pi += z.piSwitchings;
+  }
+  piSwitchings += pi;
+
+  printf("segment %d: %u..%u ms, %zu records, %zu switchings, "
+    "%d of the heater in PI mode, %d mismatches\n",
+    index, start, end, seg.events.size(), recorded.size(), pi, mismatches);
+  for (int i = 0; i < TRACE_MAX_ZONES; i++) {
+    if (!zones[i].known)
+      continue;
+    for (int kind : CLIMATE_KINDS)
+      printf("  zone %d %-7s on %8.1f s recorded %8.1f s replayed\n",
+        i, KIND_NAMES[kind],
+        zones[i].recordedOn[kind] / 1000.0, zones[i].replayedOn[kind] / 1000.0);
+  }
+  return mismatches;
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: replay [-t tolerance_ms] [-w warmup_ms] [-s step_ms] [-p n] "
+    "[-v] trace\n");
+  exit(2);
+}
+
+int main(int argc, char ** argv) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:w:s:p:v")) != -1) {
+    switch (opt) {
+      case 't': tolerance = atol(optarg); break;
+      case 'w': warmup = atol(optarg); break;
+      case 's': step = atol(optarg); break;
+      case 'p': minPi = atoi(optarg); break;
+      case 'v': verbose = true; break;
+      default: usage();
+    }
+  }
+  if (optind != argc - 1 || step == 0)
+    usage();
+
+  std::vector<Page> pages = readPages(argv[optind]);
+  std::vector<Segment> segs = segments(pages);
+
+  if (segs.empty()) {
+    fprintf(stderr, "%s: no trace pages\n", argv[optind]);
+    return 2;
+  }
+
+  int mismatches = 0;
+  for (size_t i = 0; i < segs.size(); i++)
+    mismatches += replay(segs[i], i);
+
+  if (piSwitchings < minPi) {
+    printf("%d heater switchings in PI mode, expected at least %d\n",
+      piSwitchings, minPi);
+    return 1;
+  }
+  return mismatches ? 1 : 0;
+}
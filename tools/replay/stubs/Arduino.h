@@ -0,0 +1,35 @@
+/*
+ * Just enough of the Arduino core for the recorder to build the
+ * firmware trace writer on the host; see record.cpp.
+ */
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define A1 15
+#define A2 16
+#define A3 17
+
+#define constrain(amt, low, high) \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+
+class Print {
+  public:
+    virtual size_t write(uint8_t c) = 0;
+    virtual ~Print() {}
+};
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef BOUNCE2_STUB_H
+#define BOUNCE2_STUB_H
+
+class Bounce {
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef DHT_STUB_H
+#define DHT_STUB_H
+
+#include <stdint.h>
+
+#define DHT22 22
+
+class DHT {
+  public:
+    DHT(uint8_t pin, uint8_t type);
+};
+
+#endif
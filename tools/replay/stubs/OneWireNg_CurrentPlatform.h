@@ -0,0 +1,14 @@
+#ifndef ONEWIRENG_STUB_H
+#define ONEWIRENG_STUB_H
+
+#include <stdint.h>
+
+class OneWireNg {
+  public:
+    typedef uint8_t Id[8];
+};
+
+class OneWireNg_CurrentPlatform : public OneWireNg {
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef MBED_STUB_H
+#define MBED_STUB_H
+
+#include <stdint.h>
+
+namespace mbed {
+/* backed by a simulated flash in record.cpp */
+class FlashIAP {
+  public:
+    int init();
+    int deinit() { return 0; }
+    int read(void * buffer, uint32_t address, uint32_t size);
+    int program(const void * buffer, uint32_t address, uint32_t size);
+    int erase(uint32_t address, uint32_t size);
+    uint32_t get_flash_start() const;
+    uint32_t get_flash_size() const;
+};
+}
+
+/* the recorder is single-threaded; the safety timer is a plain call */
+static inline void core_util_critical_section_enter() {}
+static inline void core_util_critical_section_exit() {}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef PLACEHOLDER_STUB_H
+#define PLACEHOLDER_STUB_H
+
+template <class T> class Placeholder {
+  private:
+    alignas(T) unsigned char buffer[sizeof(T)];
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * Downloads the trace of an incubator over /control (trace_info,
+ * trace_read) and writes it as 256-byte flash pages for replay.
+ * With -f the unit first writes out the page it is filling.
+ *
+ * Usage: tracefetch [-f] host[:port] output
+ */
+
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "../gateway/protocol.h"
+#include "constants.h"
+
+#define PAYLOAD (FLASH_PAGE_SIZE - 8)
+#define PAGES_PER_REQUEST 3
+
+static const char * host;
+static const char * port = "80";
+
+/* one POST /control with the given command lines; the reply in full */
+static std::string request(const std::string & commands) {
+  addrinfo hints = addrinfo(), * res;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res) != 0) {
+    fprintf(stderr, "%s: cannot resolve\n", host);
+    exit(2);
+  }
+
+  int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+    perror(host);
+    exit(2);
+  }
+  freeaddrinfo(res);
+
+  std::string tx = "POST /control HTTP/1.1\r\n\r\n" + commands;
+  if (write(fd, tx.data(), tx.size()) != (ssize_t)tx.size()) {
+    perror("write");
+    exit(2);
+  }
+
+  std::string rx;
+  char buf[1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    rx.append(buf, n);
+  close(fd);
+  return rx;
+}
+
+static bool is(const Slice & s, const char * text) {
+  return s.len == strlen(text) && memcmp(s.ptr, text, s.len) == 0;
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+static void putLe32(uint8_t * p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* "<seq> <hex>" into a flash page; false if malformed */
+static bool parsePage(const Slice & value, uint8_t * page) {
+  const char * p = value.ptr;
+  const char * end = value.ptr + value.len;
+  uint32_t seq = strtoul(p, (char **)&p, 10);
+
+  if (p >= end || *p++ != ' ' || end - p != 2 * PAYLOAD)
+    return false;
+
+  putLe32(page, TRACE_MAGIC);
+  putLe32(page + 4, seq);
+  for (int i = 0; i < PAYLOAD; i++) {
+    int hi = hexDigit(p[2 * i]), lo = hexDigit(p[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    page[8 + i] = (hi << 4) | lo;
+  }
+  return true;
+}
+
+int main(int argc, char ** argv) {
+  bool flush = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f")) != -1) {
+    if (opt == 'f')
+      flush = true;
+    else
+      return 2;
+  }
+  if (optind != argc - 2) {
+    fprintf(stderr, "usage: tracefetch [-f] host[:port] output\n");
+    return 2;
+  }
+
+  std::string addr = argv[optind];
+  size_t colon = addr.find(':');
+  if (colon != std::string::npos) {
+    addr[colon] = '\0';
+    port = argv[optind] + colon + 1;
+  }
+  host = addr.c_str();
+
+  std::string info = request(flush ? "trace_flush\r\ntrace_info\r\n"
+                                   : "trace_info\r\n");
+  ReplyReader reader(info.data(), info.size());
+  Slice key, value;
+  uint32_t first = 0, next = 0;
+
+  if (!reader.ok()) {
+    fprintf(stderr, "%s: bad reply\n", host);
+    return 2;
+  }
+  while (reader.next(key, value)) {
+    if (is(key, "trace_first"))
+      first = strtoul(std::string(value.ptr, value.len).c_str(), NULL, 10);
+    else if (is(key, "trace_next"))
+      next = strtoul(std::string(value.ptr, value.len).c_str(), NULL, 10);
+  }
+
+  FILE * out = fopen(argv[optind + 1], "wb");
+  if (!out) {
+    perror(argv[optind + 1]);
+    return 2;
+  }
+
+  uint32_t written = 0;
+  for (uint32_t seq = first; seq != next; ) {
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "trace_read %u %d\r\n", seq, PAGES_PER_REQUEST);
+
+    std::string rx = request(cmd);
+    ReplyReader pages(rx.data(), rx.size());
+    uint32_t before = seq;
+
+    while (pages.next(key, value)) {
+      uint8_t page[FLASH_PAGE_SIZE];
+      if (is(key, "no_page")) {
+        /* overwritten meanwhile: skip it */
+        seq++;
+        break;
+      }
+      if (!is(key, "page") || !parsePage(value, page))
+        continue;
+      fwrite(page, 1, sizeof(page), out);
+      written++;
+      seq++;
+    }
+    if (seq == before) {
+      fprintf(stderr, "%s: no progress at page %u\n", host, seq);
+      break;
+    }
+  }
+
+  fclose(out);
+  fprintf(stderr, "%u pages (%u..%u)\n", written, first, next);
+  return 0;
+}